@@ -0,0 +1,118 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+/** A lock-free histogram with power of two buckets.
+
+    Bucket 0 counts zeros and bucket n counts values from 2^(n-1) up to
+    2^n - 1. One thread records values while any number of others read,
+    without either side blocking.
+ */
+class Histogram final
+{
+public:
+    enum { numBuckets = 64 };
+
+    Histogram() { reset(); }
+
+    /** Record a value, single writer (realtime) */
+    void record (uint64 value) noexcept
+    {
+        auto& bucket = buckets [getBucket (value)];
+        bucket.store (bucket.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store (total.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (value > maximum.load (std::memory_order_relaxed))
+            maximum.store (value, std::memory_order_relaxed);
+    }
+
+    /** Returns the number of values recorded */
+    uint64 getNumRecorded() const noexcept      { return total.load (std::memory_order_relaxed); }
+
+    /** Returns the largest value recorded */
+    uint64 getMaximum() const noexcept          { return maximum.load (std::memory_order_relaxed); }
+
+    /** Returns the number of values in a bucket */
+    uint64 getCount (int bucket) const noexcept
+    {
+        jassert (isPositiveAndBelow (bucket, (int) numBuckets));
+        return buckets[bucket].load (std::memory_order_relaxed);
+    }
+
+    /** Returns the smallest value counted by a bucket */
+    static uint64 getBucketStart (int bucket) noexcept
+    {
+        return bucket <= 0 ? 0 : ((uint64) 1 << (bucket - 1));
+    }
+
+    /** Returns the bucket a value is counted in */
+    static int getBucket (uint64 value) noexcept
+    {
+        if (value == 0)
+            return 0;
+       #if defined (__GNUC__) || defined (__clang__)
+        return 64 - __builtin_clzll (value);
+       #else
+        int bucket = 0;
+        while (value != 0) { value >>= 1; ++bucket; }
+        return bucket;
+       #endif
+    }
+
+    /** Returns an upper bound on the value below which a fraction (0 to 1)
+        of the recorded values fall */
+    uint64 getPercentile (double fraction) const noexcept
+    {
+        const uint64 count = getNumRecorded();
+        if (count == 0)
+            return 0;
+
+        const auto target = (uint64) std::ceil (jlimit (0.0, 1.0, fraction) * (double) count);
+        uint64 seen = 0;
+        for (int i = 0; i < numBuckets; ++i)
+        {
+            seen += getCount (i);
+            if (seen >= target)
+                return jmin (getMaximum(), i == 0 ? (uint64) 0 : (getBucketStart (i) << 1) - 1);
+        }
+
+        return getMaximum();
+    }
+
+    /** Clear all counts.
+        @note Only call this while nothing is recording
+     */
+    void reset() noexcept
+    {
+        for (auto& bucket : buckets)
+            bucket.store (0, std::memory_order_relaxed);
+        total.store (0, std::memory_order_relaxed);
+        maximum.store (0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64> buckets [numBuckets];
+    std::atomic<uint64> total;
+    std::atomic<uint64> maximum;
+
+    JUCE_DECLARE_NON_COPYABLE (Histogram)
+};
+
+}
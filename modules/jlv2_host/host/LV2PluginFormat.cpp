@@ -82,9 +82,22 @@ public:
     /** Will write to Port with correct min max ratio conversion */
     void setValue (float newValue) override
     {
-        value.set (newValue);
+        // keep reporting the old value if the module dropped the write
+        const auto expanded = convertFrom0to1 (newValue);
+        if (module.write (portIdx, sizeof(float), 0, &expanded))
+            value.set (newValue);
+    }
+
+    /** Write a value that takes effect at a frame of the coming cycle.
+        Returns false, leaving the value alone, if the module's event queue
+        is full. Audio thread only, before the module runs (realtime) */
+    bool setValueAt (float newValue, int frame)
+    {
         const auto expanded = convertFrom0to1 (newValue);
-        module.write (portIdx, sizeof(float), 0, &expanded);
+        if (! module.write (portIdx, sizeof(float), 0, &expanded, frame))
+            return false;
+        value.set (newValue);
+        return true;
     }
 
     float getDefaultValue() const override      { return convertTo0to1 (defaultValue); }
@@ -233,6 +246,7 @@ public:
           initialised (false),
           isPowerOn (false),
           tempBuffer (1, 1),
+          doubleScratch (1, 1),
           module (module_)
     {
         LV2_URID_Map* map = nullptr;
@@ -247,38 +261,59 @@ public:
         numPorts     = module->getNumPorts();
         midiPort     = module->getMidiPort();
         notifyPort   = module->getNotifyPort();
+        midiOutputPorts = module->getMidiOutputPorts();
+
+        for (auto& param : controllerParameters)
+            param.store (nullptr, std::memory_order_relaxed);
 
+        portParameters.insertMultiple (0, nullptr, (int) numPorts);
         for (uint32 p = 0; p < numPorts; ++p)
+        {
             if (module->isPortInput (p) && PortType::Control == module->getPortType (p))
-                addParameter (LV2AudioParameter::create (p, *module));
+            {
+                auto* const param = LV2AudioParameter::create (p, *module);
+                portParameters.set ((int) p, param);
+                addParameter (param);
+            }
+        }
  
         const ChannelConfig& channels (module->getChannelConfig());
         setPlayConfigDetails (channels.getNumAudioInputs(),
                               channels.getNumAudioOutputs(), 44100.0, 1024);
 
+        // controllers mapped to parameters land on their frame, the module
+        // leaves plugins that can't be split block accurate
+        module->setSampleAccurateControl (true);
+
         if (! module->hasEditor())
         {
-            jassert (module->onPortNotify == nullptr);
+            jassert (module->onPortNotifyBatch == nullptr);
             using namespace std::placeholders;
-            module->onPortNotify = std::bind (&LV2PluginInstance::portEvent, this, _1, _2, _3, _4);
+            module->onPortNotifyBatch = std::bind (&LV2PluginInstance::portEvents, this, _1, _2, _3);
         }
     }
 
     ~LV2PluginInstance()
     {
-        module->onPortNotify = nullptr;
+        module->onPortNotifyBatch = nullptr;
         module = nullptr;
     }
 
     void portEvent (uint32 port, uint32 size, uint32 protocol, const void* data)
     {
-        if (protocol != 0)
+        if (protocol != 0 || size != sizeof (float))
             return;
-        for (int i = 0; i < getParameters().size(); ++i)
-            if (auto* const param = dynamic_cast<LV2AudioParameter*> (getParameters()[i]))
-                if (port == param->getPort() && protocol == 0)
-                    { param->update (*(float*) data, true); break; }
-    };
+        if (auto* const param = portParameters [(int) port])
+            param->update (*(const float*) data, true);
+    }
+
+    /** Update parameters from a batch of coalesced control values */
+    void portEvents (const uint32* ports, const float* values, int numValues)
+    {
+        for (int i = 0; i < numValues; ++i)
+            if (auto* const param = portParameters [(int) ports[i]])
+                param->update (values[i], true);
+    }
 
     //=========================================================================
     void fillInPluginDescription (PluginDescription& desc) const
@@ -323,12 +358,17 @@ public:
         setLatencySamples (0);
     }
 
-    double getTailLengthSeconds() const { return 0.0f; }
+    double getTailLengthSeconds() const
+    {
+        const double rate = getSampleRate();
+        return rate > 0.0 ? (double) module->getSleepTail() / rate : 0.0;
+    }
+
     void* getPlatformSpecificData()  { return module->getHandle(); }
     const String getName() const     { return module->getName(); }
     bool silenceInProducesSilenceOut() const { return false; }
     bool acceptsMidi()  const        { return wantsMidiMessages; }
-    bool producesMidi() const        { return notifyPort != LV2UI_INVALID_PORT_INDEX; }
+    bool producesMidi() const        { return ! midiOutputPorts.isEmpty(); }
 
     //==============================================================================
     void prepareToPlay (double sampleRate, int blockSize)
@@ -342,7 +382,15 @@ public:
         if (initialised)
         {
             module->setSampleRate (sampleRate);
+            prepareReblocking (blockSize);
+            module->prepareBuffers ((uint32) jmax (blockSize, reblockLength));
             tempBuffer.setSize (jmax (1, getTotalNumOutputChannels()), blockSize);
+            doubleScratch.setSize (jmax (1, getTotalNumInputChannels(), getTotalNumOutputChannels()),
+                                   jmax (1, blockSize));
+            doubleMidiChunk.ensureSize (4096);
+            doubleMidiOut.ensureSize (4096);
+            midiOutput.clear();
+            midiOutput.ensureSize (4096);
             module->activate();
         }
     }
@@ -353,6 +401,10 @@ public:
             module->deactivate();
 
         tempBuffer.setSize (1, 1);
+        doubleScratch.setSize (1, 1);
+        reblockLength = 0;
+        for (auto& b : reblockBuffers)
+            b.setSize (1, 1);
     }
 
     void processBlock (AudioSampleBuffer& audio, MidiBuffer& midi)
@@ -378,41 +430,225 @@ public:
             { }
         }
 
-        const ChannelConfig& chans (module->getChannelConfig());
+        midiOutput.clear();
 
-        if (wantsMidiMessages)
+        if (reblockLength > 0)
         {
-            PortBuffer* const buf = module->getPortBuffer (midiPort);
+            processReblocked (audio, midi);
+        }
+        else
+        {
+            runModule (audio, midi);
+            readMidiOutput (midiOutput);
+        }
+
+        // copy rather than swap, so midiOutput keeps the capacity reserved
+        // in prepareToPlay and never grows on the audio thread
+        midi.clear();
+        midi.addEvents (midiOutput, 0, -1, 0);
+    }
+
+    bool supportsDoublePrecisionProcessing() const { return true; }
+
+    Module& getModule() const { return *module; }
+
+    /** Non realtime processing freewheels the module */
+    void setNonRealtime (bool isNonRealtime) noexcept
+    {
+        AudioPluginInstance::setNonRealtime (isNonRealtime);
+        module->setFreewheel (isNonRealtime);
+    }
+
+    /** Runs the float path on samples converted into a buffer allocated in
+        prepareToPlay.  Blocks longer than prepared are split into chunks. */
+    void processBlock (AudioBuffer<double>& audio, MidiBuffer& midi)
+    {
+        const int numSamples  = audio.getNumSamples();
+        const int numChannels = jmin (audio.getNumChannels(), doubleScratch.getNumChannels());
+        const int chunkSize   = doubleScratch.getNumSamples();
+
+        if (numSamples <= chunkSize)
+        {
+            processDoubleChunk (audio, midi, 0, numSamples, numChannels);
+            return;
+        }
+
+        doubleMidiOut.clear();
+        for (int pos = 0; pos < numSamples; pos += chunkSize)
+        {
+            const int n = jmin (chunkSize, numSamples - pos);
+            doubleMidiChunk.clear();
+            doubleMidiChunk.addEvents (midi, pos, n, -pos);
+            processDoubleChunk (audio, doubleMidiChunk, pos, n, numChannels);
+            doubleMidiOut.addEvents (doubleMidiChunk, 0, n, pos);
+        }
+
+        midi.clear();
+        midi.addEvents (doubleMidiOut, 0, -1, 0);
+    }
+
+    void processDoubleChunk (AudioBuffer<double>& audio, MidiBuffer& midi,
+                             int start, int numSamples, int numChannels)
+    {
+        for (int c = 0; c < numChannels; ++c)
+            SampleConversion::toFloat (doubleScratch.getWritePointer (c),
+                                       audio.getReadPointer (c, start), numSamples);
+
+        AudioSampleBuffer chunk (doubleScratch.getArrayOfWritePointers(), numChannels, numSamples);
+        processBlock (chunk, midi);
+
+        for (int c = 0; c < numChannels; ++c)
+            SampleConversion::toDouble (audio.getWritePointer (c, start),
+                                        doubleScratch.getReadPointer (c), numSamples);
+    }
+
+    void runModule (AudioSampleBuffer& audio, MidiBuffer& midi)
+    {
+        PortBuffer* const buf = wantsMidiMessages ? module->getPortBuffer (midiPort) : nullptr;
+        if (buf != nullptr)
             buf->reset();
+
+        if (buf != nullptr || numControllers.load (std::memory_order_relaxed) > 0)
+        {
             MidiBuffer::Iterator iter (midi);
             const uint8* d = nullptr;  int s = 0, f = 0;
             while (iter.getNextEvent (d, s, f))
-                buf->addEvent (static_cast<uint32> (f), static_cast<uint32> (s), midiEvent, d);
+            {
+                if (writeController (d, s, f))
+                    continue;
+                if (buf != nullptr)
+                    buf->addEvent (static_cast<uint32> (f), static_cast<uint32> (s), midiEvent, d);
+            }
         }
         
         module->referAudioReplacing (audio);
-        module->run ((uint32) numSamples);
-        midi.clear();
+        module->run ((uint32) audio.getNumSamples());
+    }
+
+    /** Writes a MIDI controller mapped to a parameter at the frame it arrived
+        on. Returns false if the message isn't a mapped controller (realtime) */
+    bool writeController (const uint8* data, int size, int frame)
+    {
+        if (size != 3 || (data[0] & 0xf0) != 0xb0)
+            return false;
+
+        auto* const param = controllerParameters[data[1] & 0x7f].load (std::memory_order_acquire);
+        if (param == nullptr)
+            return false;
+
+        // with the event queue full the value lands at the start of the
+        // cycle instead, rather than being lost
+        const float newValue = (float) (data[2] & 0x7f) / 127.f;
+        if (! param->setValueAt (newValue, frame))
+            param->setValue (newValue);
+        return true;
+    }
+
+    /** Route a MIDI controller to a parameter, or remove it with -1 */
+    bool setControllerParameter (int controller, int parameterIndex)
+    {
+        if (! isPositiveAndBelow (controller, 128))
+            return false;
+
+        LV2AudioParameter* param = nullptr;
+        if (parameterIndex >= 0)
+        {
+            param = dynamic_cast<LV2AudioParameter*> (getParameters()[parameterIndex]);
+            if (param == nullptr)
+                return false;
+        }
+
+        auto* const old = controllerParameters[controller].exchange (param, std::memory_order_acq_rel);
+        numControllers.fetch_add ((param != nullptr ? 1 : 0) - (old != nullptr ? 1 : 0),
+                                  std::memory_order_relaxed);
+        return true;
+    }
+
+    /** Appends MIDI from every atom output port, reading the sequences in place */
+    void readMidiOutput (MidiBuffer& dest)
+    {
+        for (const auto port : midiOutputPorts)
+        {
+            auto* const seq = (LV2_Atom_Sequence*) module->getPortBuffer (port)->getPortData();
+            LV2_ATOM_SEQUENCE_FOREACH (seq, ev)
+            {
+                if (ev->body.type == midiEvent)
+                    dest.addEvent (LV2_ATOM_BODY_CONST (&ev->body),
+                                   static_cast<int> (ev->body.size),
+                                   static_cast<int> (ev->time.frames));
+            }
+        }
+    }
+
+    //==============================================================================
+    /** Plugins needing fixed or power of two block lengths are fed through a
+        pair of buffers.  Host samples are collected into one of them while
+        the other, processed on the previous fill, is played back.  This adds
+        exactly one block of latency. */
+    void prepareReblocking (int blockSize)
+    {
+        reblockLength = 0;
+        reblockFill   = 0;
 
-        // if (notifyPort != LV2UI_INVALID_PORT_INDEX)
-        // {
-        //     PortBuffer* const buf = buffers.getUnchecked (notifyPort);
-        //     jassert (buf != nullptr);
-
-        //     midi.clear();
-        //     LV2_ATOM_SEQUENCE_FOREACH ((LV2_Atom_Sequence*) buf->getPortData(), ev)
-        //     {
-        //         if (ev->body.type == uris->midi_MidiEvent)
-        //         {
-        //             midi.addEvent (LV2_ATOM_BODY_CONST (&ev->body),
-        //                            ev->body.size, (int32)ev->time.frames);
-        //         }
-        //     }
-        // }
-        // else
-        // {
-        //     midi.clear();
-        // }
+        if (module->requiresFixedBlockLength() || module->requiresPowerOf2BlockLength())
+        {
+            auto& world = module->getWorld();
+            reblockLength = jlimit (world.getMinBlockLength(), world.getMaxBlockLength(), blockSize);
+            if (module->requiresPowerOf2BlockLength())
+                reblockLength = jmin (nextPowerOfTwo (reblockLength), world.getMaxBlockLength());
+
+            module->setBlockLength ((uint32) reblockLength);
+
+            const int numChannels = jmax (1, getTotalNumInputChannels(), getTotalNumOutputChannels());
+            for (auto& b : reblockBuffers)
+            {
+                b.setSize (numChannels, reblockLength);
+                b.clear();
+            }
+
+            reblockInput = 0;
+            reblockMidi.clear();
+            reblockMidi.ensureSize (4096);
+            reblockMidiOut.clear();
+            reblockMidiOut.ensureSize (4096);
+        }
+
+        setLatencySamples (reblockLength);
+    }
+
+    void processReblocked (AudioSampleBuffer& audio, MidiBuffer& midi)
+    {
+        const int numSamples = audio.getNumSamples();
+        const int numIns  = getTotalNumInputChannels();
+        const int numOuts = getTotalNumOutputChannels();
+
+        for (int pos = 0; pos < numSamples;)
+        {
+            auto& input  = reblockBuffers [reblockInput];
+            auto& output = reblockBuffers [1 - reblockInput];
+            const int n  = jmin (reblockLength - reblockFill, numSamples - pos);
+
+            for (int c = 0; c < numIns; ++c)
+                input.copyFrom (c, reblockFill, audio, c, pos, n);
+            for (int c = 0; c < numOuts; ++c)
+                audio.copyFrom (c, pos, output, c, reblockFill, n);
+            reblockMidi.addEvents (midi, pos, n, reblockFill - pos);
+            midiOutput.addEvents (reblockMidiOut, reblockFill, n, pos - reblockFill);
+
+            reblockFill += n;
+            pos += n;
+
+            if (reblockFill == reblockLength)
+            {
+                // process in place, then play it back while the other fills
+                runModule (input, reblockMidi);
+                reblockMidi.clear();
+                reblockMidiOut.clear();
+                readMidiOutput (reblockMidiOut);
+                reblockFill  = 0;
+                reblockInput = 1 - reblockInput;
+            }
+        }
     }
 
     bool hasEditor() const { return module->hasEditor(); }
@@ -479,7 +715,20 @@ private:
     mutable StringArray programNames;
 
     AudioSampleBuffer tempBuffer;
+    AudioSampleBuffer doubleScratch;
+    MidiBuffer doubleMidiChunk, doubleMidiOut;
     ScopedPointer<Module> module;
+
+    int reblockLength = 0, reblockFill = 0, reblockInput = 0;
+    AudioSampleBuffer reblockBuffers[2];
+    MidiBuffer reblockMidi, reblockMidiOut;
+
+    Array<uint32> midiOutputPorts;
+    Array<LV2AudioParameter*> portParameters;   ///< indexed by port, null for non parameters
+    std::atomic<LV2AudioParameter*> controllerParameters [128];  ///< by MIDI controller number
+    std::atomic<int> numControllers { 0 };
+    MidiBuffer midiOutput;
+
     OwnedArray<PortBuffer> buffers;
 
     uint32 numPorts;
@@ -857,6 +1106,7 @@ public:
 
     OptionalScopedPointer<World> world;
     SymbolMap symbols;
+    bool sleepWhenIdle = false;
 
 private:
     bool useExternalData;
@@ -892,6 +1142,93 @@ private:
 LV2PluginFormat::LV2PluginFormat() : priv (new Internal()) { }
 LV2PluginFormat::~LV2PluginFormat() { priv = nullptr; }
 
+void LV2PluginFormat::setSleepWhenIdle (bool sleep) { priv->sleepWhenIdle = sleep; }
+bool LV2PluginFormat::isSleepWhenIdle() const       { return priv->sleepWhenIdle; }
+
+void LV2PluginFormat::setNumWorkerThreads (int numThreads) { priv->world->getWorkerPool().setNumThreads (numThreads); }
+int LV2PluginFormat::getNumWorkerThreads() const          { return priv->world->getNumWorkThreads(); }
+int LV2PluginFormat::getWorkerQueueDepth() const          { return priv->world->getWorkerPool().getQueueDepth(); }
+void LV2PluginFormat::setWorkerBufferSize (int bytes)      { priv->world->setWorkerBufferSize ((uint32) jmax (0, bytes)); }
+int LV2PluginFormat::getWorkerBufferSize() const          { return (int) priv->world->getWorkerBufferSize(); }
+
+bool LV2PluginFormat::setRunProfile (AudioPluginInstance& instance, RunProfile* profile)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+    {
+        lv2->getModule().setRunProfile (profile);
+        return true;
+    }
+
+    return false;
+}
+
+bool LV2PluginFormat::setControllerParameter (AudioPluginInstance& instance, int controller, int parameterIndex)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+        return lv2->setControllerParameter (controller, parameterIndex);
+    return false;
+}
+
+bool LV2PluginFormat::setStatsEnabled (AudioPluginInstance& instance, bool enabled)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+    {
+        lv2->getModule().setStatsEnabled (enabled);
+        return true;
+    }
+
+    return false;
+}
+
+ModuleStats* LV2PluginFormat::getStats (AudioPluginInstance& instance)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+        return &lv2->getModule().getStats();
+    return nullptr;
+}
+
+bool LV2PluginFormat::setWorkerTracing (AudioPluginInstance& instance, bool enabled)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+    {
+        lv2->getModule().setWorkerTracing (enabled);
+        return true;
+    }
+
+    return false;
+}
+
+int LV2PluginFormat::collectWorkerTrace (AudioPluginInstance& instance, Array<var>& traceEvents, int pid)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+        return lv2->getModule().collectWorkerTrace (traceEvents, pid);
+    return 0;
+}
+
+String LV2PluginFormat::createChromeTrace (const Array<var>& traceEvents)
+{
+    DynamicObject::Ptr trace (new DynamicObject());
+    trace->setProperty ("traceEvents", traceEvents);
+    trace->setProperty ("displayTimeUnit", "ns");
+    return JSON::toString (var (trace.get()));
+}
+
+bool LV2PluginFormat::setWorkerBufferSize (AudioPluginInstance& instance, int bytes)
+{
+    if (auto* lv2 = dynamic_cast<LV2PluginInstance*> (&instance))
+    {
+        auto& module = lv2->getModule();
+        if (module.getWorkerBufferSize() == 0)
+            return false;
+
+        const ScopedLock sl (instance.getCallbackLock());
+        module.setWorkerBufferSize ((uint32) jmax (0, bytes));
+        return true;
+    }
+
+    return false;
+}
+
 //=============================================================================
 void LV2PluginFormat::findAllTypesForFile (OwnedArray <PluginDescription>& results,
                                            const String& fileOrIdentifier)
@@ -987,25 +1324,39 @@ void LV2PluginFormat::createPluginInstance (const PluginDescription& desc, doubl
         return;
     }
 
-    if (Module* module = priv->createModule (desc.fileOrIdentifier))
+    String error;
+    if (Module* module = instantiateModule (desc.fileOrIdentifier, initialSampleRate, initialBufferSize, error))
     {
-        Result res (module->instantiate (initialSampleRate));
-        if (res.wasOk())
-        {
-            AudioPluginInstance* i = new LV2PluginInstance (*priv->world, module);
-            callback (std::unique_ptr<AudioPluginInstance> (i), {});
-        }
-        else
-        {
-            deleteAndZero (module);
-            callback (nullptr, res.getErrorMessage());
-        }
+        AudioPluginInstance* i = new LV2PluginInstance (*priv->world, module);
+        callback (std::unique_ptr<AudioPluginInstance> (i), {});
     }
     else
+    {
+        callback (nullptr, error);
+    }
+}
+
+Module* LV2PluginFormat::instantiateModule (const String& uri, double sampleRate,
+                                            int blockSize, String& errorMessage)
+{
+    std::unique_ptr<Module> module (priv->createModule (uri));
+    if (module == nullptr)
     {
         JLV2_LOG ("Failed creating LV2 plugin instance");
-        callback (nullptr, "Failed creating LV2 plugin instance");
+        errorMessage = "Failed creating LV2 plugin instance";
+        return nullptr;
     }
+
+    module->setBlockLength ((uint32) jmax (1, blockSize));
+    module->setSleepEnabled (priv->sleepWhenIdle);
+    const Result res (module->instantiate (sampleRate));
+    if (res.failed())
+    {
+        errorMessage = res.getErrorMessage();
+        return nullptr;
+    }
+
+    return module.release();
 }
 
 }
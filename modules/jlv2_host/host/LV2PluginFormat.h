@@ -39,6 +39,87 @@ public:
     FileSearchPath getDefaultLocationsToSearch() override;
     bool isTrivialToScan() const override { return true; }
 
+    /** Let plugins created from now on sleep while their input is idle.
+        Sleeping plugins skip processing once their tail has passed and the
+        output is silent, and wake up on new input. Off by default.
+      */
+    void setSleepWhenIdle (bool sleep);
+
+    /** Returns true if new plugins sleep while idle */
+    bool isSleepWhenIdle() const;
+
+    /** Set how many threads run plugin worker requests. This can be changed
+        at any time, the default comes from JLV2_NUM_WORKERS.
+      */
+    void setNumWorkerThreads (int numThreads);
+
+    /** Returns the number of threads running plugin worker requests */
+    int getNumWorkerThreads() const;
+
+    /** Returns the number of plugins waiting for a worker thread */
+    int getWorkerQueueDepth() const;
+
+    /** Set the smallest worker request and response buffer, in bytes, for
+        plugins created from now on. Plugins whose ports ask for large
+        buffers with rsz:minimumSize get room for messages that large.
+      */
+    void setWorkerBufferSize (int bytes);
+
+    /** Returns the smallest worker buffer size given to new plugins */
+    int getWorkerBufferSize() const;
+
+    /** Accumulate the run timing of an LV2 plugin instance into a profile.
+        Pass nullptr to stop. Returns false if the instance isn't from this
+        format. Don't change the profile while the plugin is processing.
+      */
+    static bool setRunProfile (AudioPluginInstance& instance, RunProfile* profile);
+
+    /** Route a MIDI controller to a parameter of an LV2 plugin instance, or
+        pass -1 to remove it. Controller messages sent to processBlock then
+        set the parameter at the sample they arrive on instead of being
+        passed to the plugin. Returns false if the instance isn't from this
+        format or the controller or parameter is out of range.
+        @see Module::setSampleAccurateControl
+      */
+    static bool setControllerParameter (AudioPluginInstance& instance, int controller, int parameterIndex);
+
+    /** Start or stop recording DSP load statistics for an LV2 plugin instance.
+        Returns false if the instance isn't from this format.
+      */
+    static bool setStatsEnabled (AudioPluginInstance& instance, bool enabled);
+
+    /** Returns the statistics of an LV2 plugin instance, or nullptr if it
+        isn't from this format. They can be read from any thread for as long
+        as the instance exists.
+      */
+    static ModuleStats* getStats (AudioPluginInstance& instance);
+
+    /** Start or stop tracing the worker requests and responses of an LV2
+        plugin instance. Worker latencies are also added to its stats.
+        Returns false if the instance isn't from this format.
+      */
+    static bool setWorkerTracing (AudioPluginInstance& instance, bool enabled);
+
+    /** Move the worker trace events an LV2 plugin instance recorded so far
+        into an array of Chrome trace events. Call this regularly while
+        tracing, the instance only holds a few thousand events. Returns the
+        number of requests and responses added.
+        @see createChromeTrace
+      */
+    static int collectWorkerTrace (AudioPluginInstance& instance, Array<var>& traceEvents, int pid = 1);
+
+    /** Returns trace events as JSON for chrome://tracing or Perfetto */
+    static String createChromeTrace (const Array<var>& traceEvents);
+
+    /** Resize the worker buffers of an LV2 plugin instance, or pass 0 to go
+        back to the default size. Takes the instance's callback lock, so
+        the resize waits for the current block to finish. Work pending in
+        the buffers is dropped. Returns false if the instance isn't from this
+        format or has no worker.
+        @note This is NOT realtime safe
+      */
+    static bool setWorkerBufferSize (AudioPluginInstance& instance, int bytes);
+
 protected:
     void createPluginInstance (const PluginDescription&,
                                double initialSampleRate,
@@ -48,8 +129,13 @@ protected:
     bool requiresUnblockedMessageThreadDuringCreation (const PluginDescription&) const noexcept override { return false; }
 
 private:
+    friend class ModuleGraph;
     class Internal;
     ScopedPointer<Internal> priv;
+
+    /** Create and instantiate the plugin for a URI, or return nullptr with
+        an error message. The caller owns the result */
+    Module* instantiateModule (const String& uri, double sampleRate, int blockSize, String& errorMessage);
 };
 
 }
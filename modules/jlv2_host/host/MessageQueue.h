@@ -0,0 +1,203 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+namespace jlv2 {
+
+/** Use as the Header of a MessageQueue whose messages carry only a payload */
+struct NoHeader {};
+
+/** A single producer, single consumer queue of variable length messages.
+
+    Each message is a typed Header followed by a payload of any size. A
+    message is written into the ring in one piece and published with a
+    single commit, so the reader never sees part of one. Messages never
+    wrap: when one won't fit before the end of the ring, the rest of the
+    ring is skipped with a padding frame. Readers therefore get the header
+    and payload in place, without copying.
+
+    Frames are 8 byte aligned. The largest payload that always fits is
+    given by getMaxPayloadSize(), about half the capacity.
+
+    @tparam Header  a trivially copyable type, aligned to 8 bytes or less
+ */
+template <typename Header>
+class MessageQueue final
+{
+public:
+    explicit MessageQueue (uint32 capacity)
+        : ring ((int32) jmax (capacity, (uint32) minimumCapacity))
+    {
+        static_assert (alignof (Header) <= frameAlignment, "Header is over aligned");
+        static_assert (std::is_trivially_copyable<Header>::value, "Header must be trivially copyable");
+    }
+
+    /** Resize and empty the queue. The capacity is rounded up to a power of two.
+        @note This is NOT realtime safe, and neither side may be in use
+     */
+    void setCapacity (uint32 newCapacity)
+    {
+        ring.setCapacity ((int32) jmax (newCapacity, (uint32) minimumCapacity));
+    }
+
+    /** Returns the size of the ring in bytes */
+    uint32 getCapacity() const noexcept     { return (uint32) ring.size(); }
+
+    /** Returns the number of ring bytes a message with this payload uses */
+    static constexpr uint32 getFrameSize (uint32 payloadSize) noexcept
+    {
+        return align (sizeof (Frame)) + headerSpace + align (payloadSize);
+    }
+
+    /** Returns the largest payload that can always be written to an empty queue */
+    uint32 getMaxPayloadSize() const noexcept
+    {
+        const uint32 limit = (getCapacity() + frameAlignment) / 2;
+        const uint32 overhead = getFrameSize (0);
+        return limit > overhead ? limit - overhead : 0;
+    }
+
+    //=========================================================================
+    /** Write a message (producer, realtime)
+        Returns false if there isn't room for it */
+    bool write (const Header& header, const void* payload, uint32 size) noexcept
+    {
+        const uint32 frameSize = getFrameSize (size);
+        auto span = ring.reserve (frameSize);
+        if (span.isEmpty())
+            return false;
+
+        uint32 skip = 0;
+        if (! span.isContiguous())
+        {
+            // pad out the end of the ring and write from the start
+            skip = span.first.size;
+            span = ring.reserve (skip + frameSize);
+            if (span.isEmpty())
+                return false;
+
+            const Frame padding = { skip, paddingFrame };
+            memcpy (span.first.buffer, &padding, sizeof (Frame));
+        }
+
+        auto* const dest = static_cast<uint8*> (skip > 0 ? span.second.buffer : span.first.buffer);
+        const Frame frame = { frameSize, size };
+        memcpy (dest, &frame, sizeof (Frame));
+        if (headerSpace > 0)
+            memcpy (dest + align (sizeof (Frame)), &header, sizeof (Header));
+        if (size > 0)
+            memcpy (dest + align (sizeof (Frame)) + headerSpace, payload, size);
+
+        ring.commit (skip + frameSize);
+        return true;
+    }
+
+    /** Write a message that has no payload (producer, realtime) */
+    bool write (const Header& header) noexcept  { return write (header, nullptr, 0); }
+
+    //=========================================================================
+    /** Read the next message, if there is one (consumer, realtime)
+
+        The callback is called as fn (const Header&, const void* payload, uint32 size).
+        The header and payload point into the ring and are only valid
+        during the call. Returns false if the queue was empty.
+     */
+    template <typename Callback>
+    bool read (Callback&& fn)
+    {
+        uint32 bytes = 0;
+        return readNext (fn, bytes);
+    }
+
+    /** Read the messages that were ready when this was called (consumer, realtime)
+        Messages written meanwhile are left for the next call, so a callback
+        that causes more messages can't keep this from returning.
+        Returns the number of messages read */
+    template <typename Callback>
+    uint32 readAll (Callback&& fn)
+    {
+        const uint32 ready = ring.getReadSpace();
+        uint32 bytes = 0, count = 0;
+        while (bytes < ready && readNext (fn, bytes))
+            ++count;
+        return count;
+    }
+
+    /** Returns true if there's nothing to read (consumer) */
+    bool isEmpty() const noexcept           { return ring.getReadSpace() == 0; }
+
+private:
+    enum : uint32 {
+        frameAlignment  = 8,
+        minimumCapacity = 64,
+        paddingFrame    = 0xffffffff
+    };
+
+    struct Frame
+    {
+        uint32 length;      ///< bytes in the frame, including this
+        uint32 size;        ///< payload size, or paddingFrame
+    };
+
+    static constexpr uint32 align (size_t bytes) noexcept
+    {
+        return (uint32) ((bytes + frameAlignment - 1) & ~(size_t) (frameAlignment - 1));
+    }
+
+    static constexpr uint32 headerSpace = std::is_empty<Header>::value ? 0
+        : (uint32) ((sizeof (Header) + frameAlignment - 1) & ~(size_t) (frameAlignment - 1));
+
+    RingBuffer ring;
+
+    /** Read one message, skipping padding, and add the bytes used to total */
+    template <typename Callback>
+    bool readNext (Callback& fn, uint32& total)
+    {
+        for (;;)
+        {
+            const auto head = ring.peek (sizeof (Frame));
+            if (head.isEmpty())
+                return false;
+
+            const auto* const frame = static_cast<const Frame*> (head.first.buffer);
+            const uint32 frameSize = frame->length;
+            const auto message = ring.peek (frameSize);
+            jassert (message.isContiguous() && ! message.isEmpty());
+            total += frameSize;
+
+            if (frame->size != paddingFrame)
+            {
+                const auto* const data = static_cast<const uint8*> (message.first.buffer);
+                fn (*reinterpret_cast<const Header*> (data + align (sizeof (Frame))),
+                    static_cast<const void*> (data + align (sizeof (Frame)) + headerSpace),
+                    frame->size);
+                ring.consume (frameSize);
+                return true;
+            }
+
+            ring.consume (frameSize);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (MessageQueue)
+};
+
+template <typename Header>
+constexpr uint32 MessageQueue<Header>::headerSpace;
+
+}
@@ -78,7 +78,7 @@ public:
 
     void sendControlValues()
     {
-        if (! ui && ! owner.onPortNotify)
+        if (! ui && ! owner.onPortNotify && ! owner.onPortNotifyBatch)
             return;
 
         for (const auto* port : ports.getPorts())
@@ -94,7 +94,235 @@ public:
             if (owner.onPortNotify)
                 owner.onPortNotify ((uint32_t) port->index, sizeof(float), 
                                     0, buffer->getPortData());
+            addToBatch ((uint32) port->index, buffer->getValue());
         }
+
+        flushBatch();
+    }
+
+    /** Queue a control value for onPortNotifyBatch, replacing any value
+        already queued for the port */
+    void addToBatch (uint32 port, float value)
+    {
+        if (! owner.onPortNotifyBatch)
+            return;
+
+        auto& slot = batchSlots [port];
+        if (slot < 0)
+        {
+            slot = numBatched++;
+            batchPorts [slot] = port;
+        }
+
+        batchValues [slot] = value;
+    }
+
+    /** Deliver queued control values to onPortNotifyBatch */
+    void flushBatch()
+    {
+        if (numBatched <= 0)
+            return;
+
+        for (int i = 0; i < numBatched; ++i)
+            batchSlots [batchPorts [i]] = -1;
+
+        const int count = numBatched;
+        numBatched = 0;
+
+        if (owner.onPortNotifyBatch)
+            owner.onPortNotifyBatch (batchPorts.get(), batchValues.get(), count);
+    }
+
+    /** Set a control port value and notify listeners (realtime) */
+    void applyControlValue (uint32 port, float value)
+    {
+        auto* const buffer = buffers.getUnchecked ((int) port);
+        if (buffer->getValue() == value)
+            return;
+
+        buffer->setValue (value);
+        controlsChanged = true;
+        portValues.set (port, value);
+    }
+
+    /** Publish output control values that changed during run (realtime) */
+    void publishOutputControls()
+    {
+        for (const auto port : outputControls)
+        {
+            const float value = buffers.getUnchecked ((int) port)->getValue();
+            if (value != portValues.get (port))
+                portValues.set (port, value);
+        }
+    }
+
+    /** Queue a control value to be applied at a frame in this cycle (realtime)
+        Returns false if there is no room left to queue it */
+    bool addPendingControl (int64 frame, uint32 port, float value)
+    {
+        if (numPending >= maxPending)
+            return false;
+
+        // insertion sort keeps events in frame order and stable per port
+        int i = numPending++;
+        while (i > 0 && pending[i - 1].frame > frame)
+        {
+            pending[i] = pending[i - 1];
+            --i;
+        }
+
+        pending[i].frame = frame;
+        pending[i].port  = port;
+        pending[i].value = value;
+        return true;
+    }
+
+    /** Run the plugin in sub-blocks split at pending control events (realtime) */
+    void runSegmented (uint32 nframes)
+    {
+        const auto minLength = static_cast<uint32> (owner.world.getMinBlockLength());
+        const auto maxLength = static_cast<uint32> (owner.world.getMaxBlockLength());
+
+        for (auto* const buffer : buffers)
+            if (buffer->isSequence() && ! buffer->isInput())
+                buffer->clear();
+
+        int next = 0;
+        uint32 start = 0;
+
+        while (start < nframes)
+        {
+            while (next < numPending && pending[next].frame <= (int64) start)
+            {
+                applyControlValue (pending[next].port, pending[next].value);
+                ++next;
+            }
+
+            uint32 end = next < numPending
+                ? static_cast<uint32> (jmin ((int64) nframes, pending[next].frame))
+                : nframes;
+
+            if (end - start < minLength)
+                end = jmin (nframes, start + minLength);
+            if (nframes - end < minLength)
+                end = nframes;
+            end = jmin (end, start + maxLength);
+
+            runSegment (start, end, end >= nframes);
+            start = end;
+        }
+
+        // anything left over was scheduled past the end of this cycle
+        for (; next < numPending; ++next)
+            applyControlValue (pending[next].port, pending[next].value);
+        numPending = 0;
+    }
+
+    void runSegment (uint32 start, uint32 end, bool isLast)
+    {
+        for (int i = 0; i < buffers.size(); ++i)
+        {
+            auto* const buffer = buffers.getUnchecked (i);
+
+            if (buffer->isAudio() || buffer->isCV())
+            {
+                owner.connectPort ((uint32) i, (float*) buffer->getPortData() + start);
+            }
+            else if (auto* const segment = segments.getUnchecked (i))
+            {
+                if (buffer->isInput())
+                {
+                    segment->clear();
+                    LV2_ATOM_SEQUENCE_FOREACH ((LV2_Atom_Sequence*) buffer->getPortData(), ev)
+                    {
+                        if (ev->time.frames < (int64) start || (! isLast && ev->time.frames >= (int64) end))
+                            continue;
+                        segment->addEvent (ev->time.frames - start, ev->body.size, ev->body.type,
+                                           (const uint8*) LV2_ATOM_BODY_CONST (&ev->body));
+                    }
+                }
+                else
+                {
+                    segment->reset();
+                }
+
+                owner.connectPort ((uint32) i, segment->getPortData());
+            }
+        }
+
+        lilv_instance_run (owner.instance, end - start);
+
+        for (int i = 0; i < buffers.size(); ++i)
+        {
+            auto* const segment = segments.getUnchecked (i);
+            if (segment == nullptr || segment->isInput())
+                continue;
+
+            auto* const buffer = buffers.getUnchecked (i);
+            LV2_ATOM_SEQUENCE_FOREACH ((LV2_Atom_Sequence*) segment->getPortData(), ev)
+                buffer->addEvent (ev->time.frames + start, ev->body.size, ev->body.type,
+                                  (const uint8*) LV2_ATOM_BODY_CONST (&ev->body));
+        }
+    }
+
+    /** Returns the buffer size for the plugin's worker. Unless set on the
+        module, this is the World's size or room for the largest message the
+        plugin's ports ask for with rsz:minimumSize, whichever is larger. */
+    uint32 getWorkerBufferSize() const
+    {
+        if (workerBufferSize > 0)
+            return workerBufferSize;
+
+        uint32 largest = 0;
+        for (uint32 i = 0; i < owner.numPorts; ++i)
+        {
+            const LilvPort* port = lilv_plugin_get_port_by_index (owner.plugin, i);
+            if (LilvNodes* sizes = lilv_port_get_value (owner.plugin, port, owner.world.rsz_minimumSize))
+            {
+                LILV_FOREACH (nodes, iter, sizes)
+                {
+                    const LilvNode* size = lilv_nodes_get (sizes, iter);
+                    if (lilv_node_is_int (size))
+                        largest = jmax (largest, (uint32) jmax (0, lilv_node_as_int (size)));
+                }
+                lilv_nodes_free (sizes);
+            }
+        }
+
+        return jmax (owner.world.getWorkerBufferSize(), WorkerBase::getSizeForMessage (largest));
+    }
+
+    /** Replace the World's options with ones that pin the block length and
+        add the buf-size features the plugin asked for */
+    void addBlockLengthFeatures (Array<const LV2_Feature*>& features)
+    {
+        if (! fixedBlockLength && ! powerOf2BlockLength)
+            return;
+
+        blockLengthValue = static_cast<int32> (owner.blockLength);
+        const auto intType = owner.map (LV2_ATOM__Int);
+        int n = 0;
+        for (const auto* key : { LV2_BUF_SIZE__minBlockLength,
+                                 LV2_BUF_SIZE__maxBlockLength,
+                                #ifdef LV2_BUF_SIZE__nominalBlockLength
+                                 LV2_BUF_SIZE__nominalBlockLength,
+                                #endif
+                               })
+        {
+            blockOptions[n++] = LV2_Options_Option { LV2_OPTIONS_INSTANCE, 0, owner.map (key),
+                                                     sizeof (int32), intType, &blockLengthValue };
+        }
+        blockOptions[n] = LV2_Options_Option { LV2_OPTIONS_BLANK, 0, 0, 0, 0, nullptr };
+        optionsFeature.data = blockOptions;
+
+        for (int i = 0; i < features.size(); ++i)
+            if (features[i] != nullptr && strcmp (features[i]->URI, LV2_OPTIONS__options) == 0)
+                features.set (i, &optionsFeature);
+
+        if (fixedBlockLength)
+            features.add (&fixedBlockFeature);
+        if (powerOf2BlockLength)
+            features.add (&powerOf2Feature);
     }
 
     static const void * getPortValue (const char *port_symbol, void *user_data, uint32_t *size, uint32_t *type)
@@ -169,8 +397,203 @@ private:
 
     HeapBlock<float> mins, maxes, defaults;    
     OwnedArray<PortBuffer> buffers;
+    HeapBlock<void*> connections;   ///< last location handed to each port
+
+    PortValueTable controlValues;   ///< untimed float control writes, last value wins
+    PortValueTable portValues;      ///< latest control port values for the UI and host
+    Array<uint32> outputControls;   ///< output control ports, published after each run
+
+    HeapBlock<int> batchSlots;      ///< per port index into the batch, or -1
+    HeapBlock<uint32> batchPorts;
+    HeapBlock<float> batchValues;
+    int numBatched = 0;
+
+    struct PendingControl
+    {
+        int64  frame;
+        uint32 port;
+        float  value;
+    };
+
+    struct CopyBack
+    {
+        const float* source;
+        float*       dest;
+    };
+
+    bool inPlaceBroken = false;
+    uint32 maxBlockLength = 0;
+    HeapBlock<float> silence;            ///< shared by unconnected audio inputs
+    HeapBlock<CopyBack> copyBacks;       ///< outputs which can't run in place
+    int numCopyBacks = 0;
+
+    bool fixedBlockLength = false;
+    bool powerOf2BlockLength = false;
+    int32 blockLengthValue = 0;
+    LV2_Options_Option blockOptions[4];
+    LV2_Feature optionsFeature      { LV2_OPTIONS__options, nullptr };
+    LV2_Feature fixedBlockFeature   { LV2_BUF_SIZE__fixedBlockLength, nullptr };
+    LV2_Feature powerOf2Feature     { LV2_BUF_SIZE__powerOf2BlockLength, nullptr };
+
+    bool sampleAccurate = false;
+    bool canSplit = true;
+    HeapBlock<PendingControl> pending;
+    int numPending = 0, maxPending = 0;
+    OwnedArray<PortBuffer> segments;   ///< per port sub-block sequences, null for non-atom ports
+
+    bool freewheel = false;
+    uint32 workerBufferSize = 0;        ///< set on the module, 0 for the default
+    bool workerTracing = false;
+    int64 traceIds = 0;                 ///< ids for async trace events
+    RunProfile* profile = nullptr;
+    ModuleStats stats;
+    Atomic<int> statsEnabled;
+    const double nanosPerTick = 1.0e9 / (double) Time::getHighResolutionTicksPerSecond();
+
+    /** Returns the current time if profiling or recording stats, otherwise 0 (realtime) */
+    int64 stamp() const noexcept
+    {
+        return profile != nullptr || statsEnabled.get() != 0 ? Time::getHighResolutionTicks() : 0;
+    }
+
+    uint64 toNanos (int64 ticks) const noexcept
+    {
+        return (uint64) jmax (0.0, (double) ticks * nanosPerTick);
+    }
+
+    bool sleepEnabled = false;
+    Atomic<int> sleeping;
+    bool controlsChanged = false;
+    bool inputIdle = false;
+    uint32 sleepTail = 0;           ///< configured tail, 0 to measure it
+    Atomic<int> measuredTail;       ///< longest input to output silence seen
+    int64 silentInputFrames = 0;    ///< frames since the input went silent
+    int64 silentOutputFrames = 0;   ///< frames the output has been silent
 
     LV2_Feature instanceFeature { LV2_INSTANCE_ACCESS_URI, nullptr };
+
+    /** Below this peak a signal counts as silent, about -100dB */
+    static constexpr float silenceThreshold = 1.0e-5f;
+
+    /** How long the outputs must stay silent before sleeping when the tail
+        is measured instead of configured, in seconds */
+    static constexpr double silenceHoldSeconds = 0.1;
+
+    static bool isSilent (const float* data, uint32 nframes)
+    {
+        if (data == nullptr || nframes == 0)
+            return true;
+        const auto range = FloatVectorOperations::findMinAndMax (data, (int) nframes);
+        return jmax (-range.getStart(), range.getEnd()) < silenceThreshold;
+    }
+
+    /** Returns true if nothing arrived this cycle that needs the plugin to run (realtime) */
+    bool isInputIdle (uint32 nframes) const
+    {
+        if (controlsChanged || numPending > 0)
+            return false;
+
+        for (const auto* buffer : buffers)
+        {
+            if (! buffer->isInput())
+                continue;
+
+            if (buffer->isAudio() || buffer->isCV())
+            {
+                if (! isSilent ((const float*) buffer->getPortData(), nframes))
+                    return false;
+            }
+            else if (buffer->isAtom())
+            {
+                const auto* seq = (const LV2_Atom_Sequence*) buffer->getPortData();
+                if (seq->atom.size > sizeof (LV2_Atom_Sequence_Body))
+                    return false;
+            }
+            else if (buffer->isEvent())
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /** Returns true if every audio and CV output is silent (realtime) */
+    bool isOutputSilent (uint32 nframes) const
+    {
+        for (const auto* buffer : buffers)
+            if (! buffer->isInput() && (buffer->isAudio() || buffer->isCV()))
+                if (! isSilent ((const float*) buffer->getPortData(), nframes))
+                    return false;
+        return true;
+    }
+
+    void clearOutputs (uint32 nframes)
+    {
+        for (auto* buffer : buffers)
+        {
+            if (buffer->isInput())
+                continue;
+            if (buffer->isAudio() || buffer->isCV())
+                FloatVectorOperations::clear ((float*) buffer->getPortData(), (int) nframes);
+            else if (buffer->isSequence())
+                buffer->clear();
+        }
+    }
+
+    /** Decide whether to run the plugin this cycle, returns false when it
+        should sleep. Inputs are checked before running since in place
+        outputs overwrite them. (realtime) */
+    bool shouldRun (uint32 nframes)
+    {
+        if (! sleepEnabled)
+            return true;
+
+        inputIdle = isInputIdle (nframes);
+        controlsChanged = false;
+
+        if (! inputIdle)
+        {
+            sleeping.set (0);
+            silentInputFrames = silentOutputFrames = 0;
+            return true;
+        }
+
+        return sleeping.get() == 0;
+    }
+
+    /** Follow the tail after a cycle which ran with idle input and go to
+        sleep once it has passed and the outputs are silent (realtime) */
+    void updateSleep (uint32 nframes)
+    {
+        if (! sleepEnabled || ! inputIdle || sleeping.get() != 0)
+            return;
+
+        silentInputFrames += nframes;
+
+        if (! isOutputSilent (nframes))
+        {
+            silentOutputFrames = 0;
+            return;
+        }
+
+        if (silentOutputFrames == 0)
+        {
+            const auto tail = jmin ((int64) std::numeric_limits<int>::max(),
+                                    silentInputFrames - (int64) nframes);
+            if (tail > (int64) measuredTail.get())
+                measuredTail.set ((int) tail);
+        }
+
+        silentOutputFrames += nframes;
+
+        const bool tailDone = sleepTail > 0
+            ? silentInputFrames >= (int64) sleepTail
+            : silentOutputFrames >= (int64) (owner.currentSampleRate * silenceHoldSeconds);
+
+        if (tailDone)
+            sleeping.set (1);
+    }
 };
 
 Module::Module (World& world_, const void* plugin_)
@@ -179,6 +602,7 @@ Module::Module (World& world_, const void* plugin_)
      world (world_),
      active (false),
      currentSampleRate (44100.0),
+     blockLength (1024),
      numPorts (lilv_plugin_get_num_ports (plugin)),
      events (nullptr)
 {
@@ -199,23 +623,30 @@ void Module::activatePorts()
 
 void Module::init()
 {
-    events.reset (new RingBuffer (4096));
-    evbufsize = jmax (evbufsize, static_cast<uint32> (256));
-    evbuf.realloc (evbufsize);
-    evbuf.clear (evbufsize);
-
-    notifications.reset (new RingBuffer (4096));
-    ntbufsize = jmax (ntbufsize, static_cast<uint32> (256));
-    ntbuf.realloc (ntbufsize);
-    ntbuf.clear (ntbufsize);
+    events.reset (new MultiProducerQueue<PortEvent> (4096));
 
     // create and set default port values
     priv->mins.allocate (numPorts, true);
     priv->maxes.allocate (numPorts, true);
     priv->defaults.allocate (numPorts, true);
+    priv->connections.allocate (numPorts, true);
+    priv->batchSlots.allocate (numPorts, false);
+    priv->batchPorts.allocate (numPorts, true);
+    priv->batchValues.allocate (numPorts, true);
+    priv->controlValues.resize (numPorts);
+    priv->portValues.resize (numPorts);
+    for (uint32 p = 0; p < numPorts; ++p)
+        priv->batchSlots[p] = -1;
 
     lilv_plugin_get_port_ranges_float (plugin, priv->mins, priv->maxes, priv->defaults);
 
+    priv->inPlaceBroken       = lilv_plugin_has_feature (plugin, world.lv2_inPlaceBroken);
+    priv->fixedBlockLength    = lilv_plugin_has_feature (plugin, world.bufsz_fixedBlockLength);
+    priv->powerOf2BlockLength = lilv_plugin_has_feature (plugin, world.bufsz_powerOf2BlockLength);
+
+    // sub-blocks would break the block length these plugins were promised
+    priv->canSplit = ! (priv->fixedBlockLength || priv->powerOf2BlockLength);
+
     // initialize each port
     for (uint32 p = 0; p < numPorts; ++p)
     {
@@ -240,6 +671,9 @@ void Module::init()
         lilv_node_free (nameNode); nameNode = nullptr;
         const String symbol  = lilv_node_as_string (lilv_port_get_symbol (plugin, port));
 
+        if (type == PortType::Event)
+            priv->canSplit = false;
+
         priv->ports.add (type, p, priv->ports.size (type, isInput),
                          symbol, name, isInput);
         priv->channels.addPort (type, p, isInput);
@@ -278,9 +712,16 @@ void Module::init()
             new PortBuffer (isInput, type, dataType, capacity));
         
         if (type == PortType::Control)
+        {
             buf->setValue (priv->defaults [p]);
+            if (! isInput)
+                priv->outputControls.add (p);
+        }
     }
 
+    priv->copyBacks.allocate ((size_t) jmax (1, priv->channels.getNumAudioOutputs()), true);
+    prepareBuffers (blockLength);
+
     // load related GUIs
     if (auto* related = lilv_plugin_get_related (plugin, world.ui_UI))
     {
@@ -391,11 +832,17 @@ Result Module::instantiate (double samplerate)
         const LilvNode* node = lilv_nodes_get (nodes, iter);
         if (lilv_node_equals (node, world.work_interface))
         {
-            worker = new WorkerFeature (world.getWorkThread(), 1);
+            worker = new WorkerFeature (world.getWorkerPool(), priv->getWorkerBufferSize());
+            worker->setSynchronous (priv->freewheel);
+            worker->setStats (&priv->stats);
+            worker->setTracing (priv->workerTracing);
+            worker->setTiming (priv->workerTracing || priv->statsEnabled.get() != 0);
             features.add (worker->getFeature());
         }
     }
     lilv_nodes_free (nodes); nodes = nullptr;
+
+    priv->addBlockLengthFeatures (features);
     
     features.add (nullptr);
     instance = lilv_plugin_instantiate (plugin, samplerate,
@@ -406,10 +853,12 @@ Result Module::instantiate (double samplerate)
         return Result::fail ("Could not instantiate plugin.");
     }
 
+    // a new instance has nothing connected yet
+    priv->connections.clear (numPorts);
+
     if (const void* data = getExtensionData (LV2_WORKER__interface))
     {
         jassert (worker != nullptr);
-        worker->setSize (2048);
         worker->setInterface (lilv_instance_get_handle (instance),
                               (LV2_Worker_Interface*) data);
     }
@@ -487,6 +936,28 @@ void Module::setSampleRate (double newSampleRate)
     }
 }
 
+bool Module::requiresFixedBlockLength() const    { return priv->fixedBlockLength; }
+bool Module::requiresPowerOf2BlockLength() const { return priv->powerOf2BlockLength; }
+uint32 Module::getBlockLength() const            { return blockLength; }
+
+void Module::setBlockLength (uint32 newBlockLength)
+{
+    if (newBlockLength == blockLength)
+        return;
+
+    blockLength = newBlockLength;
+
+    if (instance != nullptr && (priv->fixedBlockLength || priv->powerOf2BlockLength))
+    {
+        const bool wasActive = isActive();
+        freeInstance();
+        instantiate (currentSampleRate);
+
+        if (wasActive)
+            activate();
+    }
+}
+
 void Module::connectChannel (const PortType type, const int32 channel, void* data, const bool isInput)
 {
     connectPort (priv->channels.getPort (type, channel, isInput), data);
@@ -494,6 +965,11 @@ void Module::connectChannel (const PortType type, const int32 channel, void* dat
 
 void Module::connectPort (uint32 port, void* data)
 {
+    jassert (port < numPorts);
+    if (priv->connections[port] == data)
+        return;
+
+    priv->connections[port] = data;
     lilv_instance_connect_port (instance, port, data);
 }
 
@@ -568,6 +1044,23 @@ uint32 Module::getNotifyPort() const
     return LV2UI_INVALID_PORT_INDEX;
 }
 
+Array<uint32> Module::getMidiOutputPorts() const
+{
+    Array<uint32> ports;
+    for (uint32 i = 0; i < numPorts; ++i)
+    {
+        const LilvPort* port (getPort (i));
+        if (lilv_port_is_a (plugin, port, world.lv2_AtomPort) &&
+            lilv_port_is_a (plugin, port, world.lv2_OutputPort) &&
+            lilv_port_supports_event (plugin, port, world.midi_MidiEvent))
+        {
+            ports.add (i);
+        }
+    }
+
+    return ports;
+}
+
 const LilvPlugin* Module::getPlugin() const { return plugin; }
 
 const String Module::getPortName (uint32 index) const
@@ -822,85 +1315,343 @@ bool Module::isPortOutput (uint32 index) const
 
 void Module::timerCallback()
 {
-    PortEvent ev;
-    
-    static const uint32 pnsize = sizeof (PortEvent);
+    priv->portValues.collect ([this] (uint32 port, float value) {
+        if (auto ui = priv->ui)
+            ui->portEvent (port, sizeof (float), 0, &value);
+        if (onPortNotify)
+            onPortNotify (port, sizeof (float), 0, &value);
+        priv->addToBatch (port, value);
+    });
+
+    priv->flushBatch();
+}
 
-    for (;;)
+void Module::setFreewheel (bool freewheel)
+{
+    priv->freewheel = freewheel;
+    if (worker)
     {
-        if (! notifications->canRead (pnsize))
-            break;
+        worker->setSynchronous (freewheel);
+        // let requests queued while realtime finish before rendering
+        // offline, so the worker's requests keep their order
+        if (freewheel)
+            worker->waitUntilIdle();
+    }
+
+    if (const LilvPort* port = lilv_plugin_get_port_by_designation (
+            plugin, world.lv2_InputPort, world.lv2_freeWheeling))
+    {
+        const float value = freewheel ? 1.f : 0.f;
+        write (lilv_port_get_index (plugin, port), sizeof (float), 0, &value);
+    }
+}
+
+bool Module::isFreewheeling() const { return priv->freewheel; }
+
+void Module::setRunProfile (RunProfile* profile)
+{
+    priv->profile = profile;
+}
 
-        notifications->read (ev, false);
-        if (ev.size > 0 && notifications->canRead (pnsize + ev.size))
+void Module::setStatsEnabled (bool enabled)
+{
+    priv->statsEnabled.set (enabled ? 1 : 0);
+    if (worker)
+        worker->setTiming (enabled || priv->workerTracing);
+}
+
+bool Module::isStatsEnabled() const         { return priv->statsEnabled.get() != 0; }
+ModuleStats& Module::getStats()             { return priv->stats; }
+
+void Module::setWorkerTracing (bool enabled)
+{
+    priv->workerTracing = enabled;
+    if (worker)
+    {
+        worker->setTracing (enabled);
+        worker->setTiming (enabled || isStatsEnabled());
+    }
+}
+
+bool Module::isWorkerTracing() const        { return priv->workerTracing; }
+
+int Module::collectWorkerTrace (Array<var>& traceEvents, int pid)
+{
+    if (worker == nullptr)
+        return 0;
+
+    auto micros = [this] (int64 ticks) { return (double) ticks * priv->nanosPerTick / 1000.0; };
+
+    auto event = [&] (const char* name, const char* phase, int64 ticks, int tid) {
+        DynamicObject::Ptr e (new DynamicObject());
+        e->setProperty ("name", name);
+        e->setProperty ("cat",  "lv2.worker");
+        e->setProperty ("ph",   phase);
+        e->setProperty ("ts",   micros (ticks));
+        e->setProperty ("pid",  pid);
+        e->setProperty ("tid",  tid);
+        return e;
+    };
+
+    // an async span, these may overlap each other on one track
+    auto span = [&] (const char* name, int64 begin, int64 end) {
+        const int64 id = ++priv->traceIds;
+        for (auto ph : { std::make_pair ("b", begin), std::make_pair ("e", end) })
         {
-            notifications->advance (pnsize, false);
-            notifications->read (ntbuf, ev.size, true);
+            auto e = event (name, ph.first, ph.second, 0);
+            e->setProperty ("id", id);
+            traceEvents.add (var (e.get()));
+        }
+    };
 
-            if (ev.protocol == 0)
-            {
-                if (auto ui = priv->ui)
-                    ui->portEvent (ev.index, ev.size, ev.protocol, ntbuf.getData());
-                if (onPortNotify)
-                    onPortNotify (ev.index, ev.size, ev.protocol, ntbuf.getData());
-            }
+    BigInteger threadsSeen;
+    threadsSeen.setBit (0);
+    const int count = (int) worker->readTrace ([&] (const WorkTimes& times) {
+        // tid 0 is the audio thread, which also runs work inline while freewheeling
+        const int tid = times.thread + 1;
+
+        if (times.delivered != 0)
+        {
+            span ("response", times.responded, times.delivered);
+            return;
+        }
+
+        span ("queued", times.scheduled, times.started);
+
+        auto work = event ("work", "X", times.started, tid);
+        work->setProperty ("dur", micros (times.finished - times.started));
+        traceEvents.add (var (work.get()));
+
+        auto depth = event ("pool depth", "C", times.started, tid);
+        DynamicObject::Ptr args (new DynamicObject());
+        args->setProperty ("workers", times.depth);
+        depth->setProperty ("args", var (args.get()));
+        traceEvents.add (var (depth.get()));
+
+        threadsSeen.setBit (tid);
+    });
+
+    auto metadata = [&] (const char* name, int tid, const String& value) {
+        auto e = event (name, "M", 0, tid);
+        e->removeProperty ("ts");
+        DynamicObject::Ptr args (new DynamicObject());
+        args->setProperty ("name", value);
+        e->setProperty ("args", var (args.get()));
+        traceEvents.add (var (e.get()));
+    };
+
+    if (count > 0)
+    {
+        metadata ("process_name", 0, getName());
+        for (int tid = threadsSeen.findNextSetBit (0); tid >= 0; tid = threadsSeen.findNextSetBit (tid + 1))
+            metadata ("thread_name", tid, tid == 0 ? String ("audio") : "lv2_worker_" + String (tid));
+    }
+
+    return count;
+}
+
+void Module::setSleepEnabled (bool enabled)
+{
+    if (enabled == priv->sleepEnabled)
+        return;
+
+    priv->sleepEnabled = enabled;
+    priv->sleeping.set (0);
+    priv->silentInputFrames = priv->silentOutputFrames = 0;
+}
+
+void Module::setWorkerBufferSize (uint32 bytes)
+{
+    priv->workerBufferSize = bytes;
+    if (worker)
+        worker->setSize (priv->getWorkerBufferSize());
+}
+
+uint32 Module::getWorkerBufferSize() const
+{
+    return worker != nullptr ? worker->getSize() : 0;
+}
+
+bool Module::isSleepEnabled() const     { return priv->sleepEnabled; }
+void Module::setSleepTail (uint32 frames) { priv->sleepTail = frames; }
+uint32 Module::getSleepTail() const
+{
+    return priv->sleepTail > 0 ? priv->sleepTail : (uint32) priv->measuredTail.get();
+}
+bool Module::isSleeping() const         { return priv->sleeping.get() != 0; }
+
+void Module::setSampleAccurateControl (bool enabled)
+{
+    enabled = enabled && priv->canSplit;
+    if (enabled == priv->sampleAccurate)
+        return;
+
+    priv->numPending = 0;
+    priv->segments.clear();
+
+    if (enabled)
+    {
+        priv->maxPending = 512;
+        priv->pending.allocate ((size_t) priv->maxPending, true);
+
+        for (uint32 p = 0; p < numPorts; ++p)
+        {
+            auto* const buffer = priv->buffers.getUnchecked ((int) p);
+            priv->segments.add (buffer->isSequence()
+                ? new PortBuffer (buffer->isInput(), PortType::Atom,
+                                  map (LV2_ATOM__Sequence), buffer->getCapacity())
+                : nullptr);
         }
     }
+    else
+    {
+        priv->maxPending = 0;
+        priv->pending.free();
+    }
+
+    priv->sampleAccurate = enabled;
+}
+
+bool Module::isSampleAccurateControl() const { return priv->sampleAccurate; }
+
+void Module::prepareBuffers (uint32 maxBlockLength)
+{
+    maxBlockLength = jmax ((uint32) 1, maxBlockLength);
+    if (maxBlockLength == priv->maxBlockLength)
+        return;
+
+    priv->maxBlockLength = maxBlockLength;
+    priv->silence.allocate (maxBlockLength, true);
+
+    for (auto* const buffer : priv->buffers)
+        if (buffer->isAudio() || buffer->isCV())
+            buffer->setCapacity (maxBlockLength * sizeof (float));
 }
 
 void Module::referAudioReplacing (AudioSampleBuffer& buffer)
 {
+    jassert ((uint32) buffer.getNumSamples() <= priv->maxBlockLength);
+    const int numChannels = buffer.getNumChannels();
+
     for (int c = 0; c < priv->channels.getNumAudioInputs(); ++c)
         priv->buffers.getUnchecked ((int) priv->channels.getPort (
-            PortType::Audio, c, true))->referTo (buffer.getWritePointer (c));
+            PortType::Audio, c, true))->referTo (c < numChannels ? buffer.getWritePointer (c)
+                                                                 : priv->silence.getData());
 
+    priv->numCopyBacks = 0;
     for (int c = 0; c < priv->channels.getNumAudioOutputs(); ++c)
-        priv->buffers.getUnchecked ((int) priv->channels.getPort (
-            PortType::Audio, c, false))->referTo (buffer.getWritePointer (c));
+    {
+        auto* const port = priv->buffers.getUnchecked ((int) priv->channels.getPort (
+            PortType::Audio, c, false));
+
+        if (c < numChannels && ! priv->inPlaceBroken)
+        {
+            port->referTo (buffer.getWritePointer (c));
+            continue;
+        }
+
+        port->referTo (nullptr);
+        if (c < numChannels)
+            priv->copyBacks[priv->numCopyBacks++] = { (const float*) port->getPortData(),
+                                                      buffer.getWritePointer (c) };
+    }
 }
 
 void Module::run (uint32 nframes)
 {
-    PortEvent ev;
-    
-    static const uint32 pesize = sizeof (PortEvent);
+    const int64 start = priv->stamp();
+    uint32 numEvents = 0, numResponses = 0;
 
-    for (;;)
-    {
-        if (! events->canRead (pesize))
-            break;
-        events->read (ev, false);
-        if (ev.size > 0 && events->canRead (pesize + ev.size))
-        {
-            events->advance (pesize, false);
-            events->read (evbuf, ev.size, true);
+    priv->controlValues.collect ([this, &numEvents] (uint32 port, float value) {
+        priv->applyControlValue (port, value);
+        ++numEvents;
+    });
 
-            if (ev.protocol == 0)
-            {
-                auto* buffer = priv->buffers.getUnchecked (ev.index);                
-                if (buffer->getValue() != *((float*) evbuf.getData()))
-                {
-                    buffer->setValue (*((float*) evbuf.getData()));
-                    if (notifications->canWrite (pesize + ev.size)) 
-                    {
-                        notifications->write (ev);
-                        notifications->write (evbuf.getData(), ev.size);
-                    }
-                }
-            }
+    numEvents += events->readAll ([this] (const PortEvent& ev, const void* body, uint32 size) {
+        if (ev.protocol != 0 || size < sizeof (float))
+            return;
+
+        const float value = *static_cast<const float*> (body);
+        if (! priv->sampleAccurate || ev.time.frames <= 0 ||
+            ! priv->addPendingControl (ev.time.frames, ev.index, value))
+        {
+            priv->applyControlValue (ev.index, value);
         }
-    }
+    });
+
+    const int64 eventsDone = priv->stamp();
 
+    if (priv->profile != nullptr && priv->profile->reconnectAll)
+        priv->connections.clear (numPorts);
+
+    // only ports whose location changed since the last cycle get reconnected,
+    // output sequences get their full capacity back
     for (int i = priv->buffers.size(); --i >= 0;)
-        connectPort (static_cast<uint32> (i), priv->buffers.getUnchecked(i)->getPortData());
-    
+    {
+        auto* const buffer = priv->buffers.getUnchecked (i);
+        if (buffer->isSequence() && ! buffer->isInput())
+            buffer->reset();
+        connectPort (static_cast<uint32> (i), buffer->getPortData());
+    }
+
+    const int64 connectDone = priv->stamp();
+
     if (worker)
-        worker->processWorkResponses();
+        numResponses += worker->processWorkResponses();
+
+    const int64 responsesDone = priv->stamp();
+    int64 pluginTicks = 0;
+
+    if (! priv->shouldRun (nframes))
+    {
+        priv->clearOutputs (nframes);
+    }
+    else
+    {
+        const int64 runStart = priv->stamp();
+        if (priv->numPending > 0)
+            priv->runSegmented (nframes);
+        else
+            lilv_instance_run (instance, nframes);
+        pluginTicks = priv->stamp() - runStart;
+
+        priv->updateSleep (nframes);
+    }
+
+    for (int i = 0; i < priv->numCopyBacks; ++i)
+        FloatVectorOperations::copy (priv->copyBacks[i].dest, priv->copyBacks[i].source, (int) nframes);
+
+    priv->publishOutputControls();
 
-    lilv_instance_run (instance, nframes);
+    const int64 endRunStart = priv->stamp();
 
     if (worker)
+    {
+        // inline work responds during run, deliver it within the cycle
+        if (worker->isSynchronous())
+            numResponses += worker->processWorkResponses();
         worker->endRun();
+    }
+
+    if (start == 0)
+        return;
+
+    const int64 end = Time::getHighResolutionTicks();
+
+    if (auto* const profile = priv->profile)
+    {
+        profile->events  += eventsDone - start;
+        profile->connect += connectDone - eventsDone;
+        profile->worker  += (responsesDone - connectDone) + (end - endRunStart);
+        profile->plugin  += pluginTicks;
+        profile->total   += end - start;
+        ++profile->runs;
+    }
+
+    if (priv->statsEnabled.get() != 0)
+        priv->stats.addCycle (priv->toNanos (end - start), priv->toNanos (pluginTicks),
+                              1.0e9 * (double) nframes / currentSampleRate,
+                              numEvents, numResponses);
 }
 
 uint32 Module::map (const String& uri) const
@@ -909,23 +1660,28 @@ uint32 Module::map (const String& uri) const
     return (const_cast<World*> (&world))->map (uri);
 }
 
-void Module::write (uint32 port, uint32 size, uint32 protocol, const void* buffer)
+bool Module::write (uint32 port, uint32 size, uint32 protocol, const void* buffer, int64 frame)
 {
+    // untimed float controls only need their latest value
+    if (protocol == 0 && size == sizeof (float) && frame <= 0 && port < numPorts)
+    {
+        priv->controlValues.set (port, *(const float*) buffer);
+        return true;
+    }
+
     PortEvent event;
     zerostruct (event);
-    event.index     = port;
-    event.size      = size;
-    event.protocol  = protocol;
+    event.index       = port;
+    event.size        = size;
+    event.protocol    = protocol;
+    event.time.frames = frame;
 
-    if (events->canWrite (sizeof (PortEvent) + size))
-    {
-        events->write (event);
-        events->write (buffer, event.size);
-    }
-    else
-    {
-        DBG("lv2 plugin write buffer full.");
-    }
+    if (events->write (event, buffer, size))
+        return true;
+
+    priv->stats.addDroppedWrite();
+    DBG("lv2 plugin write buffer full.");
+    return false;
 }
 
 }
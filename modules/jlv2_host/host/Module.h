@@ -95,10 +95,15 @@ public:
     /** Destructor */
     ~Module();
 
-    /** If set will be called on the message thread when a notification
-        is received from the plugin. */
+    /** If set will be called on the message thread with the latest value
+        of each control port, input or output, that changed since the last
+        timer tick. */
     PortNotificationFunction onPortNotify;
 
+    /** If set will be called on the message thread once per timer tick with
+        the latest value of every control port that changed since the last. */
+    PortNotificationBatchFunction onPortNotifyBatch;
+
     /** Get the total number of ports for this plugin */
     uint32 getNumPorts() const;
 
@@ -124,6 +129,9 @@ public:
         used as a MIDI output */
     uint32 getNotifyPort() const;
 
+    /** Get every atom output port which supports MIDI events */
+    Array<uint32> getMidiOutputPorts() const;
+
     /** Get the underlying LV2_Handle */
     void* getHandle();
 
@@ -185,6 +193,22 @@ public:
      */
     void setSampleRate (double newSampleRate);
 
+    /** Returns true if the plugin needs every cycle to have the same length */
+    bool requiresFixedBlockLength() const;
+
+    /** Returns true if the plugin needs cycle lengths to be a power of two */
+    bool requiresPowerOf2BlockLength() const;
+
+    /** Set the block length the plugin will be run with
+        Plugins requiring fixed or power of two block lengths are given this
+        length as their min, max and nominal block length.
+        @note This will re-instantiate such plugins if the length changes
+     */
+    void setBlockLength (uint32 newBlockLength);
+
+    /** Returns the block length set with setBlockLength */
+    uint32 getBlockLength() const;
+
     //=========================================================================
 
     /** Get the plugin's extension data
@@ -229,6 +253,8 @@ public:
     void run (uint32 nframes);
 
     /** Connect a port to a data location (realtime)
+        The last location of every port is remembered, so the plugin is
+        only called when the location actually changes.
         @param port The port index to connect
         @param data A pointer to the port buffer that should be used
       */
@@ -240,12 +266,117 @@ public:
       */
     void connectChannel (const PortType type, const int32 channel, void* data, const bool isInput);
 
-    /** Connect an audio buffer setup for in place processing (realtime) */
+    /** Connect an audio buffer setup for in place processing (realtime)
+        Inputs without a channel in the buffer read silence.  Outputs without
+        a channel, and all outputs of lv2:inPlaceBroken plugins, use the
+        module's own buffers which are copied back to the channel after run.
+      */
     void referAudioReplacing (AudioSampleBuffer&);
 
+    /** Size the audio and CV port buffers for cycles of up to maxBlockLength
+        frames.  Call this before processing whenever the block size changes.
+        @note This is NOT realtime safe
+      */
+    void prepareBuffers (uint32 maxBlockLength);
+
     /** Returns a port buffer for port index (realtime) */    
     PortBuffer* getPortBuffer (uint32) const;
 
+    /** Enable or disable sample accurate control automation
+        When enabled, control values written with a frame offset are applied
+        at that frame by splitting the cycle into sub-blocks.  Sub-blocks are
+        kept within the World's min/max block lengths, so events closer than
+        the minimum block length are applied together. Plugins with event
+        ports, or that require fixed or power of two block lengths, are
+        never split and stay block accurate.
+        @note This is NOT realtime safe
+      */
+    void setSampleAccurateControl (bool enabled);
+
+    /** Returns true if sample accurate control automation is enabled */
+    bool isSampleAccurateControl() const;
+
+    /** Enable or disable sleeping while idle
+        When enabled and the audio inputs go silent, the plugin keeps running
+        for its tail and then sleeps once its outputs are silent as well. A
+        sleeping plugin isn't run, its outputs are cleared and events and worker
+        responses are still handled. Any input signal, MIDI/atom event or control
+        change wakes it up.
+        @note This is NOT realtime safe
+      */
+    void setSleepEnabled (bool enabled);
+
+    /** Returns true if sleeping while idle is enabled */
+    bool isSleepEnabled() const;
+
+    /** Set the tail in frames to keep running after the input goes silent.
+        With 0 (the default) the tail is measured by watching the outputs.
+      */
+    void setSleepTail (uint32 frames);
+
+    /** Returns the configured tail, or the longest tail measured so far */
+    uint32 getSleepTail() const;
+
+    /** Returns true if the plugin is currently sleeping */
+    bool isSleeping() const;
+
+    /** Enable or disable freewheeling for offline rendering
+        While freewheeling, worker requests run inline during run() and
+        their responses are delivered before the cycle ends, so renders are
+        deterministic. The plugin's lv2:freeWheeling port, if it has one, is
+        set to match.
+        @note This is NOT realtime safe
+      */
+    void setFreewheel (bool freewheel);
+
+    /** Returns true if freewheeling */
+    bool isFreewheeling() const;
+
+    /** Set the request and response buffer size of the plugin's worker, or
+        0 to size it from the World and the plugin's rsz:minimumSize ports.
+        Anything pending in the worker is dropped.
+        @note This is NOT realtime safe, and the plugin must not be running
+      */
+    void setWorkerBufferSize (uint32 bytes);
+
+    /** Returns the worker's buffer size, or 0 if the plugin has no worker */
+    uint32 getWorkerBufferSize() const;
+
+    /** Accumulate timing of each run into a profile, or stop with nullptr.
+        The profile isn't owned and is written from the audio thread.
+      */
+    void setRunProfile (RunProfile* profile);
+
+    /** Enable or disable recording DSP load into the stats.
+        Dropped writes are always counted.
+      */
+    void setStatsEnabled (bool enabled);
+
+    /** Returns true if DSP load is being recorded */
+    bool isStatsEnabled() const;
+
+    /** Returns this instance's statistics, safe to read from any thread */
+    ModuleStats& getStats();
+
+    /** Start or stop recording a trace of worker requests and responses.
+        Worker latencies go into the stats while stats or tracing are on.
+        @note This is NOT realtime safe
+      */
+    void setWorkerTracing (bool enabled);
+
+    /** Returns true if worker requests and responses are traced */
+    bool isWorkerTracing() const;
+
+    /** Move the worker trace events recorded so far into an array of
+        Chrome trace events, see chrome://tracing. Each request shows as
+        time queued and time running on its worker thread, and each
+        response as time waiting for delivery.
+        @param traceEvents  where to add the events
+        @param pid          the process id to file the events under
+        @returns the number of requests and responses added
+      */
+    int collectWorkerTrace (Array<var>& traceEvents, int pid);
+
     //=========================================================================
 
     /** Loads the default state if available */
@@ -261,10 +392,19 @@ public:
 
     //=========================================================================
 
-    /** Write some data to a port
-        This will send a PortEvent to the audio thread
+    /** Write some data to a port, from any thread
+        Untimed float control values go to a last value wins table read at
+        the start of the next cycle, anything else is sent to the audio
+        thread as a PortEvent.
+        @param frame Offset in frames into the next cycle. Only used for
+                     control ports when sample accurate control is enabled.
+                     Timed writes must come from the audio thread, before
+                     the run they belong to. From any other thread there is
+                     no telling which cycle reads them, so use frame 0.
+        @returns false if the event queue was full and the write was dropped
      */
-    void write (uint32 port, uint32 size, uint32 protocol, const void* buffer);
+    bool write (uint32 port, uint32 size, uint32 protocol, const void* buffer,
+                int64 frame = 0);
 
     /** Send port values to listeners now */
     void sendPortEvents();
@@ -281,16 +421,11 @@ private:
 
     bool active;
     double currentSampleRate;
+    uint32 blockLength;
     uint32 numPorts;
     Array<const LV2_Feature*> features;
 
-    std::unique_ptr<RingBuffer> events;
-    HeapBlock<uint8> evbuf;
-    uint32 evbufsize;
-
-    std::unique_ptr<RingBuffer> notifications;
-    HeapBlock<uint8> ntbuf;
-    uint32 ntbufsize;
+    std::unique_ptr<MultiProducerQueue<PortEvent>> events;
 
     OwnedArray<SupportedUI> supportedUIs;
     OwnedArray<ScalePoints> scalePoints;
@@ -462,6 +597,7 @@ public:
     
     void idle()
     {
+        flushPendingWrites();
         if (! haveIdleInterface())
             return;
         uiIdle->idle ((LV2UI_Handle) suil_instance_get_handle (instance));
@@ -542,11 +678,49 @@ private:
         return (ui->onClientResize) ? ui->onClientResize() : 0;
     }
 
+    /** A UI write the module's queue was too full to take */
+    struct PendingWrite
+    {
+        uint32 port, protocol;
+        MemoryBlock data;
+    };
+
+    enum { maxPendingWrites = 256 };
+    Array<PendingWrite> pendingWrites;  ///< message thread only, oldest first
+
+    /** Retry dropped UI writes in order. Returns true once none are left */
+    bool flushPendingWrites()
+    {
+        int sent = 0;
+        for (const auto& pending : pendingWrites)
+        {
+            if (! module.write (pending.port, (uint32) pending.data.getSize(),
+                                pending.protocol, pending.data.getData()))
+                break;
+            ++sent;
+        }
+
+        pendingWrites.removeRange (0, sent);
+        return pendingWrites.isEmpty();
+    }
+
     static void portWrite (void* controller, uint32_t port, uint32_t size,
                            uint32_t protocol, void const* buffer)
     {
-        auto& plugin = (static_cast<ModuleUI*> (controller))->getPlugin();
-        plugin.write (port, size, protocol, buffer);
+        auto* ui = static_cast<ModuleUI*> (controller);
+
+        // writes wait behind dropped ones, so the plugin sees them in order.
+        // What the queue can't take is retried here and from idle()
+        if (ui->flushPendingWrites() && ui->module.write (port, size, protocol, buffer))
+            return;
+
+        if (ui->pendingWrites.size() >= maxPendingWrites)
+        {
+            DBG("lv2 ui write dropped, the plugin isn't reading its writes.");
+            return;
+        }
+
+        ui->pendingWrites.add ({ port, protocol, MemoryBlock (buffer, size) });
     }
 
     static uint32_t portIndex (void* controller, const char* symbol)
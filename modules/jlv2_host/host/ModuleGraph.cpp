@@ -0,0 +1,587 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+namespace jlv2 {
+
+/** Everything process needs, resolved from the nodes and connections.
+    Each step is a task, so the plan can also run on a ProcessScheduler. */
+struct ModuleGraph::RenderPlan : public ProcessTaskGraph
+{
+    /** An output port, or a graph input when module is null */
+    struct Source
+    {
+        Module* module;
+        uint32 port;
+    };
+
+    /** How one input port gets its data each cycle */
+    struct Route
+    {
+        PortBuffer* dest;
+        Array<Source> sources;
+        int mix;            ///< channel in mixes, or -1
+    };
+
+    struct Step
+    {
+        int nodeId;
+        Module* module;
+        Array<Route> routes;
+        int numDependencies = 0;    ///< upstream steps
+        Array<int> dependents;      ///< downstream steps
+    };
+
+    Array<Step> steps;
+    Array<Array<Source>> outputs;   ///< sources per graph output channel
+    Array<Source> midiOutputs;      ///< atom outputs feeding the graph's MIDI out
+    AudioSampleBuffer mixes;
+    uint32 midiEvent = 0;
+
+    // set for each chunk before the steps run
+    const AudioSampleBuffer* inputs = nullptr;
+    const MidiBuffer* midiIn = nullptr;
+    int numSamples = 0;
+
+    const float* getAudio (const Source& src) const
+    {
+        return src.module != nullptr ? (const float*) src.module->getPortBuffer (src.port)->getPortData()
+                                     : inputs->getReadPointer ((int) src.port);
+    }
+
+    void sum (float* dest, const Array<Source>& sources) const
+    {
+        FloatVectorOperations::copy (dest, getAudio (sources.getReference (0)), numSamples);
+        for (int i = 1; i < sources.size(); ++i)
+            FloatVectorOperations::add (dest, getAudio (sources.getReference (i)), numSamples);
+    }
+
+    //=========================================================================
+    int getNumTasks() const override                    { return steps.size(); }
+    int getNumDependencies (int task) const override    { return steps.getReference(task).numDependencies; }
+    const Array<int>& getDependents (int task) const override { return steps.getReference(task).dependents; }
+
+    /** Route a step's inputs then run its module (realtime) */
+    void runTask (int task) override
+    {
+        auto& step = steps.getReference (task);
+
+        for (auto& route : step.routes)
+        {
+            auto* const dest = route.dest;
+
+            if (route.sources.isEmpty())
+            {
+                dest->referTo (nullptr);
+                if (dest->isAtom())
+                    dest->reset();
+            }
+            else if (dest->isAtom())
+            {
+                const auto& src = route.sources.getReference (0);
+                if (src.module != nullptr)
+                {
+                    dest->referTo (src.module->getPortBuffer (src.port)->getPortData());
+                }
+                else
+                {
+                    dest->referTo (nullptr);
+                    dest->reset();
+                    MidiBuffer::Iterator iter (*midiIn);
+                    const uint8* d = nullptr;  int s = 0, f = 0;
+                    while (iter.getNextEvent (d, s, f))
+                        dest->addEvent (f, (uint32) s, midiEvent, d);
+                }
+            }
+            else if (route.mix < 0)
+            {
+                dest->referTo (const_cast<float*> (getAudio (route.sources.getReference (0))));
+            }
+            else
+            {
+                float* const mix = mixes.getWritePointer (route.mix);
+                sum (mix, route.sources);
+                dest->referTo (mix);
+            }
+        }
+
+        step.module->run ((uint32) numSamples);
+    }
+};
+
+//=============================================================================
+ModuleGraph::ModuleGraph (int numIns, int numOuts)
+    : numAudioIns (jmax (0, numIns)),
+      numAudioOuts (jmax (0, numOuts))
+{
+    rebuild();
+}
+
+ModuleGraph::~ModuleGraph()
+{
+    releaseResources();
+    plan = nullptr;
+    nodes.clear();
+}
+
+//=============================================================================
+int ModuleGraph::addPlugin (LV2PluginFormat& format, const String& uri, String& errorMessage)
+{
+    auto* module = format.instantiateModule (uri, sampleRate, blockSize, errorMessage);
+    return module != nullptr ? addModule (module) : (int) GraphIO;
+}
+
+int ModuleGraph::addModule (Module* module)
+{
+    jassert (module != nullptr);
+    if (module == nullptr)
+        return GraphIO;
+
+    // outputs are read in place downstream, so they must use their own memory
+    for (uint32 p = 0; p < module->getNumPorts(); ++p)
+        if (auto* buffer = module->getPortBuffer (p))
+            buffer->referTo (nullptr);
+
+    if (prepared)
+    {
+        module->setSampleRate (sampleRate);
+        module->prepareBuffers ((uint32) blockSize);
+        module->activate();
+    }
+
+    auto* node = nodes.add (new Node());
+    node->id = ++lastNodeId;
+    node->module = module;
+    rebuild();
+    return node->id;
+}
+
+void ModuleGraph::removeModule (int nodeId)
+{
+    auto* node = findNode (nodeId);
+    if (node == nullptr)
+        return;
+
+    for (int i = connections.size(); --i >= 0;)
+    {
+        const auto& c = connections.getReference (i);
+        if (c.sourceNode == nodeId || c.destNode == nodeId)
+            connections.remove (i);
+    }
+
+    // the node must be out of the plan before it is deleted
+    rebuild();
+
+    if (node->module->isActive())
+        node->module->deactivate();
+    nodes.removeObject (node);
+}
+
+Module* ModuleGraph::getModule (int nodeId) const
+{
+    auto* node = findNode (nodeId);
+    return node != nullptr ? node->module.get() : nullptr;
+}
+
+uint32 ModuleGraph::getNumPorts (int nodeId) const
+{
+    auto* module = getModule (nodeId);
+    return module != nullptr ? module->getNumPorts() : 0;
+}
+
+uint32 ModuleGraph::getPortIndex (int nodeId, const String& symbol) const
+{
+    auto* module = getModule (nodeId);
+    return module != nullptr ? module->getPortIndex (symbol) : JLV2_INVALID_PORT;
+}
+
+uint32 ModuleGraph::getAudioPort (int nodeId, int channel, bool isInput) const
+{
+    auto* module = getModule (nodeId);
+    if (module == nullptr)
+        return JLV2_INVALID_PORT;
+
+    const auto& channels = module->getChannelConfig();
+    const int numChannels = isInput ? channels.getNumAudioInputs() : channels.getNumAudioOutputs();
+    return isPositiveAndBelow (channel, numChannels) ? channels.getAudioPort (channel, isInput)
+                                                     : JLV2_INVALID_PORT;
+}
+
+bool ModuleGraph::setControlValue (int nodeId, uint32 port, float value)
+{
+    auto* module = getModule (nodeId);
+    if (module == nullptr || port >= module->getNumPorts() || ! module->isPortInput (port)
+          || module->getPortType (port) != PortType::Control)
+        return false;
+
+    return module->write (port, sizeof (float), 0, &value);
+}
+
+ModuleGraph::Node* ModuleGraph::findNode (int nodeId) const
+{
+    for (auto* node : nodes)
+        if (node->id == nodeId)
+            return node;
+    return nullptr;
+}
+
+//=============================================================================
+bool ModuleGraph::canConnect (const Connection& c) const
+{
+    if ((c.sourceNode == c.destNode && c.sourceNode != GraphIO) || connections.contains (c))
+        return false;
+
+    int sourceType = PortType::Unknown, destType = PortType::Unknown;
+
+    if (c.sourceNode == GraphIO)
+    {
+        if (c.sourcePort < (uint32) numAudioIns)
+            sourceType = PortType::Audio;
+        else if (c.sourcePort == getMidiInputPort())
+            sourceType = PortType::Atom;
+    }
+    else if (auto* node = findNode (c.sourceNode))
+    {
+        if (c.sourcePort < node->module->getNumPorts() && node->module->isPortOutput (c.sourcePort))
+            sourceType = node->module->getPortType (c.sourcePort).id();
+    }
+
+    if (c.destNode == GraphIO)
+    {
+        if (c.destPort < (uint32) numAudioOuts)
+            destType = PortType::Audio;
+        else if (c.destPort == getMidiOutputPort())
+            destType = PortType::Atom;
+    }
+    else if (auto* node = findNode (c.destNode))
+    {
+        if (c.destPort < node->module->getNumPorts() && node->module->isPortInput (c.destPort))
+            destType = node->module->getPortType (c.destPort).id();
+    }
+
+    if (sourceType != destType)
+        return false;
+    if (sourceType != PortType::Audio && sourceType != PortType::CV && sourceType != PortType::Atom)
+        return false;
+
+    // atom inputs read their single source in place
+    if (sourceType == PortType::Atom && c.destNode != GraphIO)
+        for (const auto& o : connections)
+            if (o.destNode == c.destNode && o.destPort == c.destPort)
+                return false;
+
+    Array<Connection> proposed (connections);
+    proposed.add (c);
+    Array<Node*> order;
+    return sortNodes (proposed, order);
+}
+
+bool ModuleGraph::connect (int sourceNode, uint32 sourcePort, int destNode, uint32 destPort)
+{
+    const Connection c { sourceNode, sourcePort, destNode, destPort };
+    if (! canConnect (c))
+        return false;
+
+    connections.add (c);
+    rebuild();
+    return true;
+}
+
+bool ModuleGraph::disconnect (int sourceNode, uint32 sourcePort, int destNode, uint32 destPort)
+{
+    const Connection c { sourceNode, sourcePort, destNode, destPort };
+    const int index = connections.indexOf (c);
+    if (index < 0)
+        return false;
+
+    connections.remove (index);
+    rebuild();
+    return true;
+}
+
+bool ModuleGraph::isConnected (int sourceNode, uint32 sourcePort, int destNode, uint32 destPort) const
+{
+    return connections.contains ({ sourceNode, sourcePort, destNode, destPort });
+}
+
+Array<int> ModuleGraph::getRenderOrder() const
+{
+    Array<int> ids;
+    Array<Node*> order;
+    if (sortNodes (connections, order))
+        for (auto* node : order)
+            ids.add (node->id);
+    return ids;
+}
+
+bool ModuleGraph::sortNodes (const Array<Connection>& conns, Array<Node*>& order) const
+{
+    // Kahn's algorithm, GraphIO is ignored since it never waits on a module
+    Array<int> inDegree;
+    inDegree.insertMultiple (0, 0, nodes.size());
+
+    for (const auto& c : conns)
+    {
+        if (c.sourceNode == GraphIO || c.destNode == GraphIO)
+            continue;
+        const int dest = nodes.indexOf (findNode (c.destNode));
+        inDegree.set (dest, inDegree[dest] + 1);
+    }
+
+    order.clearQuick();
+    for (int i = 0; i < nodes.size(); ++i)
+        if (inDegree[i] == 0)
+            order.add (nodes.getUnchecked (i));
+
+    for (int i = 0; i < order.size(); ++i)
+    {
+        const int id = order.getUnchecked(i)->id;
+        for (const auto& c : conns)
+        {
+            if (c.sourceNode != id || c.destNode == GraphIO)
+                continue;
+
+            const int dest = nodes.indexOf (findNode (c.destNode));
+            inDegree.set (dest, inDegree[dest] - 1);
+            if (inDegree[dest] == 0)
+                order.add (nodes.getUnchecked (dest));
+        }
+    }
+
+    return order.size() == nodes.size();
+}
+
+//=============================================================================
+void ModuleGraph::rebuild()
+{
+    using Source = RenderPlan::Source;
+    std::unique_ptr<RenderPlan> newPlan (new RenderPlan());
+
+    auto sourceFor = [this] (const Connection& c) -> Source {
+        if (c.sourceNode == GraphIO)
+            return { nullptr, c.sourcePort };
+        return { findNode (c.sourceNode)->module.get(), c.sourcePort };
+    };
+
+    Array<Node*> order;
+    const bool sorted = sortNodes (connections, order);
+    jassert (sorted); ignoreUnused (sorted);
+
+    int numMixes = 0;
+    for (auto* node : order)
+    {
+        auto* module = node->module.get();
+        if (newPlan->midiEvent == 0)
+            newPlan->midiEvent = module->map (LV2_MIDI__MidiEvent);
+
+        RenderPlan::Step step;
+        step.nodeId = node->id;
+        step.module = module;
+
+        for (uint32 p = 0; p < module->getNumPorts(); ++p)
+        {
+            auto* buffer = module->getPortBuffer (p);
+            if (buffer == nullptr || ! buffer->isInput())
+                continue;
+            if (! buffer->isAudio() && ! buffer->isCV() && ! buffer->isAtom())
+                continue;
+
+            RenderPlan::Route route;
+            route.dest = buffer;
+            route.mix  = -1;
+
+            for (const auto& c : connections)
+                if (c.destNode == node->id && c.destPort == p)
+                    route.sources.add (sourceFor (c));
+
+            if (route.sources.size() > 1)
+                route.mix = numMixes++;
+
+            step.routes.add (route);
+        }
+
+        newPlan->steps.add (step);
+    }
+
+    // steps are in order, so every upstream step already has an index
+    for (int i = 0; i < newPlan->steps.size(); ++i)
+    {
+        auto& step = newPlan->steps.getReference (i);
+        for (int j = 0; j < i; ++j)
+        {
+            auto& upstream = newPlan->steps.getReference (j);
+            for (const auto& c : connections)
+            {
+                if (c.sourceNode == upstream.nodeId && c.destNode == step.nodeId)
+                {
+                    upstream.dependents.add (i);
+                    ++step.numDependencies;
+                    break;
+                }
+            }
+        }
+    }
+
+    newPlan->outputs.resize (numAudioOuts);
+    for (const auto& c : connections)
+    {
+        if (c.destNode != GraphIO)
+            continue;
+        if (c.destPort == getMidiOutputPort())
+            newPlan->midiOutputs.add (sourceFor (c));
+        else
+            newPlan->outputs.getReference ((int) c.destPort).add (sourceFor (c));
+    }
+
+    newPlan->mixes.setSize (jmax (1, numMixes), jmax (1, blockSize));
+
+    {
+        const ScopedLock sl (lock);
+        std::swap (plan, newPlan);
+    }
+}
+
+//=============================================================================
+void ModuleGraph::prepareToPlay (double newSampleRate, int maxBlockSize)
+{
+    releaseResources();
+
+    sampleRate = newSampleRate;
+    blockSize  = jmax (1, maxBlockSize);
+
+    for (auto* node : nodes)
+    {
+        node->module->setSampleRate (sampleRate);
+        node->module->prepareBuffers ((uint32) blockSize);
+        node->module->activate();
+    }
+
+    inputs.setSize (jmax (1, numAudioIns), blockSize);
+    midiChunk.ensureSize (4096);
+    midiOut.ensureSize (4096);
+
+    {
+        const ScopedLock sl (lock);
+        prepared = true;
+    }
+
+    rebuild();
+}
+
+void ModuleGraph::setScheduler (ProcessScheduler* newScheduler)
+{
+    const ScopedLock sl (lock);
+    scheduler = newScheduler;
+}
+
+void ModuleGraph::releaseResources()
+{
+    const ScopedLock sl (lock);
+    if (! prepared)
+        return;
+
+    for (auto* node : nodes)
+        node->module->deactivate();
+    prepared = false;
+}
+
+//=============================================================================
+void ModuleGraph::process (AudioSampleBuffer& audio, MidiBuffer& midi)
+{
+    const ScopedLock sl (lock);
+    const int numSamples = audio.getNumSamples();
+
+    if (! prepared || plan == nullptr)
+    {
+        audio.clear();
+        midi.clear();
+        return;
+    }
+
+    midiOut.clear();
+
+    if (numSamples <= blockSize)
+    {
+        processChunk (*plan, audio, 0, numSamples, midi, midiOut);
+    }
+    else
+    {
+        for (int pos = 0; pos < numSamples; pos += blockSize)
+        {
+            const int n = jmin (blockSize, numSamples - pos);
+            midiChunk.clear();
+            midiChunk.addEvents (midi, pos, n, -pos);
+            processChunk (*plan, audio, pos, n, midiChunk, midiOut);
+        }
+    }
+
+    // copy rather than swap, so midiOut keeps its reserved capacity
+    midi.clear();
+    midi.addEvents (midiOut, 0, -1, 0);
+}
+
+void ModuleGraph::processChunk (RenderPlan& p, AudioSampleBuffer& audio, int start, int numSamples,
+                                const MidiBuffer& midiIn, MidiBuffer& midiOutput)
+{
+    // graph inputs are copied once, the host buffer is written with outputs
+    for (int c = 0; c < numAudioIns; ++c)
+    {
+        if (c < audio.getNumChannels())
+            inputs.copyFrom (c, 0, audio, c, start, numSamples);
+        else
+            inputs.clear (c, 0, numSamples);
+    }
+
+    p.inputs     = &inputs;
+    p.midiIn     = &midiIn;
+    p.numSamples = numSamples;
+
+    if (scheduler != nullptr)
+        scheduler->process (p);
+    else
+        for (int i = 0; i < p.steps.size(); ++i)
+            p.runTask (i);
+
+    for (int c = 0; c < audio.getNumChannels(); ++c)
+    {
+        float* const dest = audio.getWritePointer (c, start);
+        if (c < numAudioOuts && ! p.outputs.getReference(c).isEmpty())
+            p.sum (dest, p.outputs.getReference (c));
+        else
+            FloatVectorOperations::clear (dest, numSamples);
+    }
+
+    for (const auto& src : p.midiOutputs)
+    {
+        if (src.module == nullptr)
+        {
+            midiOutput.addEvents (midiIn, 0, numSamples, start);
+            continue;
+        }
+
+        auto* const seq = (LV2_Atom_Sequence*) src.module->getPortBuffer (src.port)->getPortData();
+        LV2_ATOM_SEQUENCE_FOREACH (seq, ev)
+        {
+            if (ev->body.type == p.midiEvent)
+                midiOutput.addEvent (LV2_ATOM_BODY_CONST (&ev->body),
+                                     static_cast<int> (ev->body.size),
+                                     static_cast<int> (ev->time.frames) + start);
+        }
+    }
+}
+
+}
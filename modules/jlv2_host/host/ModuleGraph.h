@@ -0,0 +1,181 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+/** A graph of Modules connected port to port.
+
+    Modules run in topological order, or in parallel on a ProcessScheduler
+    where branches don't depend on each other. An input fed by a single output reads
+    that output's buffer directly through PortBuffer::referTo, so audio, CV
+    and atom data pass between modules without copies. Only inputs with
+    more than one audio or CV source get mixed into a scratch buffer.
+
+    The graph's own inputs and outputs are the node GraphIO. Its audio
+    channels are ports 0 to n - 1, and MIDI is the port after the last
+    channel (see getMidiInputPort and getMidiOutputPort).
+
+    Editing the graph is NOT realtime safe. Edits build a new render plan,
+    which is swapped in under the callback lock.
+
+    Plugins are added with addPlugin, and their ports found with
+    getAudioPort or getPortIndex. The LV2PluginFormat they came from must
+    outlive the graph.
+ */
+class JLV2_API ModuleGraph final
+{
+public:
+    /** Node id of the graph's own inputs and outputs */
+    enum { GraphIO = -1 };
+
+    /** Create a graph with the given number of audio inputs and outputs */
+    ModuleGraph (int numAudioInputs, int numAudioOutputs);
+    ~ModuleGraph();
+
+    /** Instantiate an LV2 plugin and add it to the graph.
+        Returns the node id, or GraphIO with an error message if the plugin
+        couldn't be created.
+     */
+    int addPlugin (LV2PluginFormat& format, const String& uri, String& errorMessage);
+
+    /** Add an instantiated module, the graph takes ownership.
+        Returns the node id */
+    int addModule (Module* module);
+
+    /** Remove and delete a module and all its connections */
+    void removeModule (int nodeId);
+
+    /** Returns the module for a node, or nullptr */
+    Module* getModule (int nodeId) const;
+
+    /** Returns the number of modules in the graph */
+    int getNumModules() const { return nodes.size(); }
+
+    /** Returns the number of ports a node's plugin has */
+    uint32 getNumPorts (int nodeId) const;
+
+    /** Returns the port with a symbol, or JLV2_INVALID_PORT */
+    uint32 getPortIndex (int nodeId, const String& symbol) const;
+
+    /** Returns the port of an audio channel, or JLV2_INVALID_PORT */
+    uint32 getAudioPort (int nodeId, int channel, bool isInput) const;
+
+    /** Set a control input from any thread. Returns false if the value
+        couldn't be queued and was dropped */
+    bool setControlValue (int nodeId, uint32 port, float value);
+
+    /** Connect an output port to an input port.
+        Ports must be of the same type: audio, CV or atom. Control ports
+        aren't connected, write to them with Module::write instead. Atom
+        inputs accept a single source. Returns false if the ports don't
+        match or the connection would make a cycle.
+     */
+    bool connect (int sourceNode, uint32 sourcePort, int destNode, uint32 destPort);
+
+    /** Remove a connection, returns false if it didn't exist */
+    bool disconnect (int sourceNode, uint32 sourcePort, int destNode, uint32 destPort);
+
+    /** Returns true if the connection exists */
+    bool isConnected (int sourceNode, uint32 sourcePort, int destNode, uint32 destPort) const;
+
+    /** Returns the GraphIO port carrying MIDI into the graph */
+    uint32 getMidiInputPort() const     { return (uint32) numAudioIns; }
+
+    /** Returns the GraphIO port carrying MIDI out of the graph */
+    uint32 getMidiOutputPort() const    { return (uint32) numAudioOuts; }
+
+    /** Returns the node ids in the order they are processed */
+    Array<int> getRenderOrder() const;
+
+    /** Prepare every module to play, then activate them.
+        Plugins which need a fixed block length must be given blocks of
+        exactly that size.
+     */
+    void prepareToPlay (double sampleRate, int maxBlockSize);
+
+    /** Deactivate all modules */
+    void releaseResources();
+
+    /** Process one cycle of the whole graph (realtime)
+        Audio is processed in place and the MIDI buffer is replaced with the
+        MIDI sent to the graph's MIDI output. Blocks longer than the prepared
+        size are split.
+     */
+    void process (AudioSampleBuffer& audio, MidiBuffer& midi);
+
+    /** Run independent branches of the graph in parallel on a scheduler.
+        The scheduler isn't owned and must outlive the graph or be unset
+        first. Pass nullptr to process on the calling thread only.
+     */
+    void setScheduler (ProcessScheduler* scheduler);
+
+    /** Returns the scheduler in use, if any */
+    ProcessScheduler* getScheduler() const { return scheduler; }
+
+    /** Returns the lock held while processing */
+    const CriticalSection& getCallbackLock() const { return lock; }
+
+private:
+    struct Node
+    {
+        int id;
+        ScopedPointer<Module> module;
+    };
+
+    struct Connection
+    {
+        int sourceNode; uint32 sourcePort;
+        int destNode;   uint32 destPort;
+
+        bool operator== (const Connection& o) const noexcept
+        {
+            return sourceNode == o.sourceNode && sourcePort == o.sourcePort
+                && destNode == o.destNode && destPort == o.destPort;
+        }
+    };
+
+    struct RenderPlan;
+
+    const int numAudioIns, numAudioOuts;
+    OwnedArray<Node> nodes;
+    Array<Connection> connections;
+    int lastNodeId = 0;
+
+    CriticalSection lock;
+    std::unique_ptr<RenderPlan> plan;
+    ProcessScheduler* scheduler = nullptr;
+    double sampleRate = 44100.0;
+    int blockSize = 1024;
+    bool prepared = false;          ///< written under lock, process reads it there
+
+    AudioSampleBuffer inputs;
+    MidiBuffer midiChunk, midiOut;
+
+    Node* findNode (int nodeId) const;
+    bool canConnect (const Connection&) const;
+    bool sortNodes (const Array<Connection>&, Array<Node*>& order) const;
+    void rebuild();
+    void processChunk (RenderPlan&, AudioSampleBuffer& audio, int start, int numSamples,
+                       const MidiBuffer& midiIn, MidiBuffer& midiOutput);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ModuleGraph)
+};
+
+}
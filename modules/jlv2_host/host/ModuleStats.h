@@ -0,0 +1,172 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+/** DSP load, worker latency and error counters for one plugin instance.
+
+    The audio thread and the thread running a worker request record while
+    any other thread reads, all without locks. Times are in nanoseconds.
+ */
+class ModuleStats final
+{
+public:
+    ModuleStats() = default;
+
+    /** Time of each whole Module::run */
+    const Histogram& getCycleTimes() const noexcept     { return cycleTimes; }
+
+    /** Time of each call into the plugin's run */
+    const Histogram& getPluginTimes() const noexcept    { return pluginTimes; }
+
+    /** Time worker requests waited before a thread started on them */
+    const Histogram& getWorkWaitTimes() const noexcept      { return workWaitTimes; }
+
+    /** Time spent running each worker request */
+    const Histogram& getWorkRunTimes() const noexcept       { return workRunTimes; }
+
+    /** Time worker responses waited to be delivered to the plugin */
+    const Histogram& getWorkResponseTimes() const noexcept  { return workResponseTimes; }
+
+    /** Time from scheduling a worker request to delivering its response */
+    const Histogram& getWorkRoundTrips() const noexcept     { return workRoundTrips; }
+
+    /** Returns the number of cycles recorded */
+    uint64 getNumCycles() const noexcept        { return cycleTimes.getNumRecorded(); }
+
+    /** Returns the number of control values and port events applied */
+    uint64 getEventsDrained() const noexcept    { return load (eventsDrained); }
+
+    /** Returns the number of worker responses delivered */
+    uint64 getWorkerResponses() const noexcept  { return load (workerResponses); }
+
+    /** Returns the number of port writes lost to a full queue */
+    uint64 getDroppedWrites() const noexcept    { return load (droppedWrites); }
+
+    /** Returns the number of worker requests the plugin couldn't schedule */
+    uint64 getDroppedWorkRequests() const noexcept  { return load (droppedWorkRequests); }
+
+    /** Returns the number of worker responses the plugin couldn't send */
+    uint64 getDroppedWorkResponses() const noexcept { return load (droppedWorkResponses); }
+
+    /** Returns the number of cycles that went over budget */
+    uint64 getOverruns() const noexcept         { return load (overruns); }
+
+    /** Set the share of each cycle's duration this instance may use before
+        a cycle counts as an overrun. Defaults to 1.0, the whole period. */
+    void setBudget (double fractionOfCycle) noexcept { budget.store (fractionOfCycle, std::memory_order_relaxed); }
+
+    /** Returns the share of a cycle this instance may use */
+    double getBudget() const noexcept           { return budget.load (std::memory_order_relaxed); }
+
+    //=========================================================================
+    /** Record one cycle, audio thread only (realtime)
+        @param cycleNanos       time of the whole cycle
+        @param pluginNanos      time inside the plugin
+        @param periodNanos      duration of the audio processed
+        @param events           events drained this cycle
+        @param responses        worker responses delivered this cycle
+     */
+    void addCycle (uint64 cycleNanos, uint64 pluginNanos, double periodNanos,
+                   uint32 events, uint32 responses) noexcept
+    {
+        cycleTimes.record (cycleNanos);
+        pluginTimes.record (pluginNanos);
+        increment (eventsDrained, events);
+        increment (workerResponses, responses);
+        if ((double) cycleNanos > periodNanos * getBudget())
+            increment (overruns, 1);
+    }
+
+    /** Count a write dropped because its queue was full, any thread (realtime) */
+    void addDroppedWrite() noexcept
+    {
+        droppedWrites.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    /** Record a finished worker request, from whichever thread ran it
+        @param waitNanos    time from scheduling to starting
+        @param runNanos     time spent running
+     */
+    void addWorkRequest (uint64 waitNanos, uint64 runNanos) noexcept
+    {
+        workWaitTimes.record (waitNanos);
+        workRunTimes.record (runNanos);
+    }
+
+    /** Record a delivered worker response, audio thread only (realtime)
+        @param responseNanos    time from responding to delivery
+        @param roundTripNanos   time from scheduling the request to delivery
+     */
+    void addWorkResponse (uint64 responseNanos, uint64 roundTripNanos) noexcept
+    {
+        workResponseTimes.record (responseNanos);
+        workRoundTrips.record (roundTripNanos);
+    }
+
+    /** Count a worker request that didn't fit, any thread (realtime) */
+    void addDroppedWorkRequest() noexcept
+    {
+        droppedWorkRequests.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    /** Count a worker response that didn't fit, any thread (realtime) */
+    void addDroppedWorkResponse() noexcept
+    {
+        droppedWorkResponses.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    /** Clear everything.
+        @note Only call this while the audio thread and worker aren't recording
+     */
+    void reset() noexcept
+    {
+        for (auto* histogram : { &cycleTimes, &pluginTimes, &workWaitTimes,
+                                 &workRunTimes, &workResponseTimes, &workRoundTrips })
+            histogram->reset();
+        for (auto* counter : { &eventsDrained, &workerResponses, &droppedWrites,
+                               &droppedWorkRequests, &droppedWorkResponses, &overruns })
+            counter->store (0, std::memory_order_relaxed);
+    }
+
+private:
+    Histogram cycleTimes, pluginTimes;
+    Histogram workWaitTimes, workRunTimes, workResponseTimes, workRoundTrips;
+    std::atomic<uint64> eventsDrained { 0 }, workerResponses { 0 },
+                        droppedWrites { 0 }, droppedWorkRequests { 0 },
+                        droppedWorkResponses { 0 }, overruns { 0 };
+    std::atomic<double> budget { 1.0 };
+
+    static uint64 load (const std::atomic<uint64>& counter) noexcept
+    {
+        return counter.load (std::memory_order_relaxed);
+    }
+
+    /** single writer, so no read-modify-write is needed */
+    static void increment (std::atomic<uint64>& counter, uint64 amount) noexcept
+    {
+        if (amount > 0)
+            counter.store (counter.load (std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (ModuleStats)
+};
+
+}
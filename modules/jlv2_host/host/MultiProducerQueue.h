@@ -0,0 +1,235 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+namespace jlv2 {
+
+/** A multiple producer, single consumer queue of variable length messages.
+
+    Works like MessageQueue, but any number of threads may write at once
+    without locks. A writer claims its frame by advancing a shared reserve
+    position with compare and swap, fills it in, then publishes it by
+    storing the frame length. The reader delivers frames in claim order
+    and stops at the first one still being filled, so it never waits on
+    a writer.
+
+    Writes fail, rather than block or overwrite, when the queue is full.
+
+    @tparam Header  a trivially copyable type, aligned to 8 bytes or less
+ */
+template <typename Header>
+class MultiProducerQueue final
+{
+public:
+    explicit MultiProducerQueue (uint32 capacity)
+    {
+        static_assert (alignof (Header) <= frameAlignment, "Header is over aligned");
+        static_assert (std::is_trivially_copyable<Header>::value, "Header must be trivially copyable");
+        static_assert (sizeof (std::atomic<uint32>) == sizeof (uint32), "frame lengths must be plain words");
+        setCapacity (capacity);
+    }
+
+    /** Resize and empty the queue. The capacity is rounded up to a power of two.
+        @note This is NOT realtime safe, and nothing may be using the queue
+     */
+    void setCapacity (uint32 newCapacity)
+    {
+        capacity = (uint32) nextPowerOfTwo ((int) jmax (newCapacity, (uint32) minimumCapacity));
+        mask = capacity - 1;
+        block.calloc (capacity);
+        writer.position.store (0, std::memory_order_relaxed);
+        reader.position.store (0, std::memory_order_relaxed);
+    }
+
+    /** Returns the size of the ring in bytes */
+    uint32 getCapacity() const noexcept     { return capacity; }
+
+    /** Returns the number of ring bytes a message with this payload uses */
+    static constexpr uint32 getFrameSize (uint32 payloadSize) noexcept
+    {
+        return align (sizeof (Frame)) + headerSpace + align (payloadSize);
+    }
+
+    /** Returns the largest payload that can always be written to an empty queue */
+    uint32 getMaxPayloadSize() const noexcept
+    {
+        const uint32 limit = (capacity + frameAlignment) / 2;
+        const uint32 overhead = getFrameSize (0);
+        return limit > overhead ? limit - overhead : 0;
+    }
+
+    //=========================================================================
+    /** Write a message (any thread, realtime)
+        Returns false if there isn't room for it */
+    bool write (const Header& header, const void* payload, uint32 size) noexcept
+    {
+        const uint32 frameSize = getFrameSize (size);
+        uint32 pos = writer.position.load (std::memory_order_relaxed);
+        uint32 skip, index;
+
+        for (;;)
+        {
+            index = pos & mask;
+            skip  = frameSize <= capacity - index ? 0 : capacity - index;
+
+            const uint32 used = pos - reader.position.load (std::memory_order_acquire);
+            if (skip + frameSize > capacity - used)
+                return false;
+
+            if (writer.position.compare_exchange_weak (pos, pos + skip + frameSize,
+                                                       std::memory_order_relaxed,
+                                                       std::memory_order_relaxed))
+                break;
+        }
+
+        if (skip > 0)
+        {
+            // pad out the end of the ring and write from the start
+            frameAt (index).size = paddingFrame;
+            frameAt (index).length.store (skip, std::memory_order_release);
+            index = 0;
+        }
+
+        auto* const dest = block.getData() + index;
+        if (headerSpace > 0)
+            memcpy (dest + align (sizeof (Frame)), &header, sizeof (Header));
+        if (size > 0)
+            memcpy (dest + align (sizeof (Frame)) + headerSpace, payload, size);
+
+        frameAt (index).size = size;
+        frameAt (index).length.store (frameSize, std::memory_order_release);
+        return true;
+    }
+
+    /** Write a message that has no payload (any thread, realtime) */
+    bool write (const Header& header) noexcept  { return write (header, nullptr, 0); }
+
+    //=========================================================================
+    /** Read the next published message, if there is one (consumer, realtime)
+
+        The callback is called as fn (const Header&, const void* payload, uint32 size).
+        The header and payload point into the ring and are only valid
+        during the call. Returns false if nothing was ready.
+     */
+    template <typename Callback>
+    bool read (Callback&& fn)
+    {
+        return readNext (fn, writer.position.load (std::memory_order_acquire));
+    }
+
+    /** Read the messages published before this was called (consumer, realtime)
+        Returns the number of messages read */
+    template <typename Callback>
+    uint32 readAll (Callback&& fn)
+    {
+        const uint32 end = writer.position.load (std::memory_order_acquire);
+        uint32 count = 0;
+        while (readNext (fn, end))
+            ++count;
+        return count;
+    }
+
+    /** Returns true if nothing has been written since the last read (consumer) */
+    bool isEmpty() const noexcept
+    {
+        return writer.position.load (std::memory_order_acquire)
+            == reader.position.load (std::memory_order_relaxed);
+    }
+
+private:
+    enum : uint32 {
+        frameAlignment  = 8,
+        minimumCapacity = 64,
+        paddingFrame    = 0xffffffff,
+        cacheLineSize   = 64
+    };
+
+    struct Frame
+    {
+        std::atomic<uint32> length;     ///< bytes in the frame, zero until published
+        uint32 size;                    ///< payload size, or paddingFrame
+    };
+
+    /** A position on its own cache line */
+    struct Cursor
+    {
+        uint8 before [cacheLineSize];
+        std::atomic<uint32> position { 0 };
+        uint8 after [cacheLineSize - sizeof (std::atomic<uint32>)];
+    };
+
+    static constexpr uint32 align (size_t bytes) noexcept
+    {
+        return (uint32) ((bytes + frameAlignment - 1) & ~(size_t) (frameAlignment - 1));
+    }
+
+    static constexpr uint32 headerSpace = std::is_empty<Header>::value ? 0
+        : (uint32) ((sizeof (Header) + frameAlignment - 1) & ~(size_t) (frameAlignment - 1));
+
+    HeapBlock<uint8> block;
+    uint32 capacity = 0, mask = 0;
+    Cursor writer;      ///< end of the space claimed by producers
+    Cursor reader;      ///< start of the unread frames
+
+    Frame& frameAt (uint32 index) noexcept
+    {
+        return *reinterpret_cast<Frame*> (block.getData() + index);
+    }
+
+    /** Read one message before end, skipping padding */
+    template <typename Callback>
+    bool readNext (Callback& fn, uint32 end)
+    {
+        for (;;)
+        {
+            const uint32 pos = reader.position.load (std::memory_order_relaxed);
+            if (pos == end)
+                return false;
+
+            auto& frame = frameAt (pos & mask);
+            const uint32 frameSize = frame.length.load (std::memory_order_acquire);
+            if (frameSize == 0)
+                return false;   // claimed but still being written
+
+            const uint32 size = frame.size;
+            if (size != paddingFrame)
+            {
+                const auto* const data = reinterpret_cast<const uint8*> (&frame);
+                fn (*reinterpret_cast<const Header*> (data + align (sizeof (Frame))),
+                    static_cast<const void*> (data + align (sizeof (Frame)) + headerSpace),
+                    size);
+            }
+
+            // frames of later laps may start anywhere in this one, so zero
+            // all of it to keep old bytes from reading as a published length
+            memset (reinterpret_cast<uint8*> (&frame) + sizeof (uint32), 0, frameSize - sizeof (uint32));
+            frame.length.store (0, std::memory_order_relaxed);
+            reader.position.store (pos + frameSize, std::memory_order_release);
+
+            if (size != paddingFrame)
+                return true;
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (MultiProducerQueue)
+};
+
+template <typename Header>
+constexpr uint32 MultiProducerQueue<Header>::headerSpace;
+
+}
@@ -41,6 +41,10 @@ PortBuffer::PortBuffer (bool inputPort, uint32 portType, uint32 dataType, uint32
     {
         buffer.audio = (float*) data.get();
 	}
+    else if (type == PortType::CV)
+    {
+        buffer.cv = (float*) data.get();
+    }
     else if (type == PortType::Control)
     {
         buffer.control = (float*) data.get();
@@ -54,6 +58,20 @@ PortBuffer::PortBuffer (bool inputPort, uint32 portType, uint32 dataType, uint32
     reset();
 }
 
+void PortBuffer::setCapacity (uint32 newCapacity)
+{
+    newCapacity = std::max ((uint32) sizeof (float), newCapacity);
+    if (newCapacity == capacity)
+        return;
+
+    capacity = newCapacity;
+    data.reset (new uint8 [capacity]);
+    if (! referenced)
+        buffer.referred = data.get();
+
+    reset();
+}
+
 PortBuffer::~PortBuffer()
 {
     buffer.atom = nullptr;
@@ -78,7 +96,7 @@ bool PortBuffer::addEvent (int64 frames, uint32 size, uint32 bodyType, const uin
 {
     if (isSequence())
     {
-        if (sizeof(LV2_Atom) + buffer.atom->size + lv2_atom_pad_size(size) > capacity)
+        if (sizeof (LV2_Atom) + buffer.atom->size + sizeof (LV2_Atom_Event) + lv2_atom_pad_size (size) > capacity)
             return false;
 
         LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*) buffer.atom;
@@ -131,9 +149,9 @@ void PortBuffer::clear()
 
 void PortBuffer::reset()
 {
-    if (isAudio())
+    if (isAudio() || isCV())
     {
-        buffer.atom->size = capacity - sizeof (LV2_Atom);
+        memset (data.get(), 0, capacity);
 	}
     else if (isControl())
     {
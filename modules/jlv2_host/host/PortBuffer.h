@@ -36,13 +36,24 @@ public:
     
     inline uint32 getType()  const { return type; }
 
+    inline bool isInput()    const { return input; }
+
     inline bool isAtom()     const { return type == PortType::Atom; }
 	inline bool isAudio()    const { return type == PortType::Audio; }
 	inline bool isControl()  const { return type == PortType::Control; }
+    inline bool isCV()       const { return type == PortType::CV; }
     inline bool isEvent()    const { return type == PortType::Event; }
 	inline bool isSequence() const { return isAtom(); }
 
-    void referTo (void* location) { buffer.referred = location; referenced = true; }
+    /** Use external memory for this port, or the buffer's own when nullptr */
+    void referTo (void* location)
+    {
+        referenced = location != nullptr;
+        buffer.referred = referenced ? location : data.get();
+    }
+
+    /** Reallocate the buffer's own memory, e.g. to fit a longer block of audio */
+    void setCapacity (uint32 newCapacity);
 
     float getValue() const;
     void setValue (float value);
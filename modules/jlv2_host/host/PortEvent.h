@@ -32,6 +32,15 @@ using PortWriteFunction = std::function<void(uint32_t port, uint32_t size, uint3
     events come from the plugin instance. */
 using PortNotificationFunction = PortWriteFunction;
 
+/** Receives a batch of float control port values coming from the plugin
+    instance. Each port appears at most once per batch, holding the latest
+    value.
+    @param ports        Port indexes
+    @param values       Port values, parallel to ports
+    @param numValues    Number of entries in ports and values
+*/
+using PortNotificationBatchFunction = std::function<void(const uint32_t* ports, const float* values, int numValues)>;
+
 /** A simple type for writing/reading port values/messages through a ringbuffer */
 struct PortEvent
 {
@@ -0,0 +1,108 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+/** A lock-free, last value wins mailbox of float port values.
+
+    Any number of threads may set values. A single reader collects the
+    ports which changed since it last looked, so many writes to a port
+    between two reads collapse into one.
+ */
+class PortValueTable
+{
+public:
+    PortValueTable() = default;
+    ~PortValueTable() = default;
+
+    /** Resize the table, clearing all values and dirty flags
+        @note This is NOT realtime safe
+     */
+    void resize (uint32 newNumPorts)
+    {
+        numPorts = newNumPorts;
+        numWords = (numPorts + 31) / 32;
+        values.reset (new std::atomic<float> [jmax (1u, numPorts)]);
+        dirty.reset (new std::atomic<uint32> [jmax (1u, numWords)]);
+
+        for (uint32 i = 0; i < numPorts; ++i)
+            values[i].store (0.f, std::memory_order_relaxed);
+        for (uint32 i = 0; i < numWords; ++i)
+            dirty[i].store (0, std::memory_order_relaxed);
+    }
+
+    /** Returns the number of ports in the table */
+    uint32 size() const noexcept { return numPorts; }
+
+    /** Store a value and flag the port as changed (realtime, any thread) */
+    void set (uint32 port, float value) noexcept
+    {
+        jassert (port < numPorts);
+        values[port].store (value, std::memory_order_relaxed);
+        dirty[port >> 5].fetch_or (1u << (port & 31), std::memory_order_release);
+    }
+
+    /** Returns the last value stored for a port */
+    float get (uint32 port) const noexcept
+    {
+        jassert (port < numPorts);
+        return values[port].load (std::memory_order_relaxed);
+    }
+
+    /** Returns true if any port has changed since the last call to collect */
+    bool isDirty() const noexcept
+    {
+        for (uint32 i = 0; i < numWords; ++i)
+            if (dirty[i].load (std::memory_order_relaxed) != 0)
+                return true;
+        return false;
+    }
+
+    /** Calls fn (port, value) for every port changed since the last call.
+        Only one thread may collect at a time. (realtime)
+     */
+    template<class Callback>
+    void collect (Callback&& fn)
+    {
+        for (uint32 w = 0; w < numWords; ++w)
+        {
+            if (dirty[w].load (std::memory_order_relaxed) == 0)
+                continue;
+
+            uint32 bits = dirty[w].exchange (0, std::memory_order_acquire);
+            while (bits != 0)
+            {
+                const int bit = findHighestSetBit (bits);
+                bits &= ~(1u << bit);
+                const uint32 port = (w << 5) + (uint32) bit;
+                fn (port, values[port].load (std::memory_order_relaxed));
+            }
+        }
+    }
+
+private:
+    uint32 numPorts = 0, numWords = 0;
+    std::unique_ptr<std::atomic<float>[]> values;
+    std::unique_ptr<std::atomic<uint32>[]> dirty;
+
+    JUCE_DECLARE_NON_COPYABLE (PortValueTable)
+};
+
+}
@@ -0,0 +1,236 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+namespace jlv2 {
+
+/** A counting semaphore whose post never takes a lock, so the audio thread
+    can wake workers with it. WaitableEvent::signal takes a mutex.
+ */
+class ProcessScheduler::Semaphore
+{
+public:
+   #if JUCE_MAC
+    Semaphore()  { sem = dispatch_semaphore_create (0); }
+    ~Semaphore() { dispatch_release (sem); }
+    void post()  { dispatch_semaphore_signal (sem); }
+    void wait()  { dispatch_semaphore_wait (sem, DISPATCH_TIME_FOREVER); }
+   #elif JUCE_WINDOWS
+    Semaphore()  { sem = CreateSemaphore (nullptr, 0, LONG_MAX, nullptr); }
+    ~Semaphore() { CloseHandle (sem); }
+    void post()  { ReleaseSemaphore (sem, 1, nullptr); }
+    void wait()  { WaitForSingleObject (sem, INFINITE); }
+   #else
+    Semaphore()  { sem_init (&sem, 0, 0); }
+    ~Semaphore() { sem_destroy (&sem); }
+    void post()  { sem_post (&sem); }
+    void wait()  { while (sem_wait (&sem) != 0 && errno == EINTR) {} }
+   #endif
+
+private:
+   #if JUCE_MAC
+    dispatch_semaphore_t sem;
+   #elif JUCE_WINDOWS
+    HANDLE sem;
+   #else
+    sem_t sem;
+   #endif
+
+    JUCE_DECLARE_NON_COPYABLE (Semaphore)
+};
+
+class ProcessScheduler::Worker : public Thread
+{
+public:
+    Worker (ProcessScheduler& s, int i)
+        : Thread ("jlv2: process " + String (i)),
+          scheduler (s), index (i) { }
+
+    ~Worker()
+    {
+        signalThreadShouldExit();
+        wake.post();
+        stopThread (1000);
+    }
+
+    /** Wake the worker if it went to sleep waiting for this cycle (realtime) */
+    void notify()
+    {
+        if (sleeping.exchange (false))
+            wake.post();
+    }
+
+    void run() override
+    {
+        uint32 seen = scheduler.cycle.load (std::memory_order_acquire);
+
+        while (! threadShouldExit())
+        {
+            if (! waitForCycle (seen))
+                break;
+            seen = scheduler.cycle.load (std::memory_order_acquire);
+            scheduler.runUntilDone (index);
+        }
+    }
+
+private:
+    ProcessScheduler& scheduler;
+    const int index;
+    Semaphore wake;
+    std::atomic<bool> sleeping { false };
+
+    bool cycleStarted (uint32 seen) const
+    {
+        return scheduler.cycle.load (std::memory_order_seq_cst) != seen;
+    }
+
+    /** Spins briefly for the next cycle then sleeps on the semaphore.
+        Returns false if the thread should exit. */
+    bool waitForCycle (uint32 seen)
+    {
+        for (int spin = 0; spin < wakeSpinBudget; ++spin)
+        {
+            if (cycleStarted (seen))
+                return true;
+            if (threadShouldExit())
+                return false;
+            Thread::yield();
+        }
+
+        // process bumps the cycle before notify, so either it sees sleeping
+        // and posts, or this sees the new cycle. If notify already took the
+        // flag a post is on its way and has to be consumed.
+        sleeping.store (true, std::memory_order_seq_cst);
+        if (! cycleStarted (seen) || ! sleeping.exchange (false))
+            wake.wait();
+
+        return ! threadShouldExit();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (Worker)
+};
+
+//=============================================================================
+ProcessScheduler::ProcessScheduler (int numThreads, int initialMaxTasks)
+{
+    numThreads = jmax (1, numThreads);
+    for (int i = 0; i < numThreads; ++i)
+        deques.add (new WorkStealingDeque());
+
+    setMaxTasks (initialMaxTasks);
+
+    for (int i = 1; i < numThreads; ++i)
+        workers.add (new Worker (*this, i))->startThread (10);
+}
+
+ProcessScheduler::~ProcessScheduler()
+{
+    workers.clear();
+    deques.clear();
+}
+
+void ProcessScheduler::setMaxTasks (int newMaxTasks)
+{
+    maxTasks = jmax (1, newMaxTasks);
+    remaining.reset (new std::atomic<int> [(size_t) maxTasks]);
+    for (auto* deque : deques)
+        deque->reset (maxTasks);
+}
+
+//=============================================================================
+void ProcessScheduler::process (ProcessTaskGraph& graph)
+{
+    const int numTasks = graph.getNumTasks();
+
+    if (numTasks <= 1 || numTasks > maxTasks || workers.isEmpty())
+    {
+        for (int t = 0; t < numTasks; ++t)
+            graph.runTask (t);
+        return;
+    }
+
+    current.store (&graph, std::memory_order_relaxed);
+    for (int t = 0; t < numTasks; ++t)
+        remaining[t].store (graph.getNumDependencies (t), std::memory_order_relaxed);
+    tasksLeft.store (numTasks, std::memory_order_release);
+
+    for (int t = numTasks; --t >= 0;)
+        if (graph.getNumDependencies (t) == 0)
+            deques.getUnchecked(0)->push (t);
+
+    cycle.fetch_add (1, std::memory_order_seq_cst);
+    for (auto* worker : workers)
+        worker->notify();
+
+    runUntilDone (0);
+    current.store (nullptr, std::memory_order_relaxed);
+}
+
+void ProcessScheduler::runUntilDone (int thread)
+{
+    int task = 0, misses = 0;
+    while (tasksLeft.load (std::memory_order_acquire) > 0)
+    {
+        if (findTask (thread, task))
+        {
+            runTask (thread, task);
+            misses = 0;
+        }
+        else if (thread != 0 && ++misses >= idleSpinBudget)
+        {
+            // the caller finishes whatever is left
+            return;
+        }
+        else
+        {
+            Thread::yield();
+        }
+    }
+}
+
+bool ProcessScheduler::findTask (int thread, int& task)
+{
+    if (deques.getUnchecked(thread)->pop (task))
+        return true;
+
+    const int numThreads = deques.size();
+    for (int i = 1; i < numThreads; ++i)
+        if (deques.getUnchecked ((thread + i) % numThreads)->steal (task))
+            return true;
+
+    return false;
+}
+
+void ProcessScheduler::runTask (int thread, int task)
+{
+    auto* const graph = current.load (std::memory_order_acquire);
+    graph->runTask (task);
+
+    for (const int dependent : graph->getDependents (task))
+    {
+        if (remaining[dependent].fetch_sub (1, std::memory_order_acq_rel) == 1)
+        {
+            // deques hold maxTasks, so there is always room
+            const bool pushed = deques.getUnchecked(thread)->push (dependent);
+            jassert (pushed); ignoreUnused (pushed);
+        }
+    }
+
+    tasksLeft.fetch_sub (1, std::memory_order_release);
+}
+
+}
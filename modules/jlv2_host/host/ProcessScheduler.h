@@ -0,0 +1,110 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+class WorkStealingDeque;
+
+/** A set of tasks with dependencies, run by a ProcessScheduler.
+    Task indexes must already be a valid serial order, which is used when
+    the tasks are run on a single thread.
+ */
+class JLV2_API ProcessTaskGraph
+{
+public:
+    virtual ~ProcessTaskGraph() = default;
+
+    /** Returns the number of tasks */
+    virtual int getNumTasks() const = 0;
+
+    /** Returns the number of tasks which must finish before this one starts */
+    virtual int getNumDependencies (int task) const = 0;
+
+    /** Returns the tasks which depend on this one */
+    virtual const Array<int>& getDependents (int task) const = 0;
+
+    /** Run a task, called from any of the scheduler's threads (realtime) */
+    virtual void runTask (int task) = 0;
+};
+
+/** Runs ProcessTaskGraphs across a pool of realtime threads.
+
+    Each thread has its own work stealing deque. A thread pushes the tasks
+    it makes ready onto its own deque, and steals from the others when that
+    runs dry. The thread calling process takes part and returns once every
+    task has finished.
+
+    Waking the workers is lock free. A worker spins for up to wakeSpinBudget
+    yields waiting for the next cycle, then sleeps on a semaphore which
+    process posts only if it did. Within a cycle a worker gives up after
+    idleSpinBudget failed looks for work in a row and the calling thread
+    finishes the rest, so idle workers never spin for a whole cycle.
+ */
+class JLV2_API ProcessScheduler final
+{
+public:
+    /** Create a scheduler which runs tasks on numThreads threads,
+        including the one calling process */
+    ProcessScheduler (int numThreads, int maxTasks = 128);
+    ~ProcessScheduler();
+
+    /** Returns the number of threads, including the one calling process */
+    int getNumThreads() const { return deques.size(); }
+
+    /** Returns the most tasks a graph can have to run in parallel */
+    int getMaxTasks() const { return maxTasks; }
+
+    /** Make room for graphs with up to this many tasks
+        @note This is NOT realtime safe, and mustn't be called while processing
+     */
+    void setMaxTasks (int maxTasks);
+
+    /** Run every task in the graph and wait for them to finish (realtime)
+        Only one thread may call process at a time. Graphs with more than
+        getMaxTasks() tasks run serially on the calling thread.
+     */
+    void process (ProcessTaskGraph& graph);
+
+    /** Yields a worker spends waiting for the next cycle before sleeping */
+    static constexpr int wakeSpinBudget = 64;
+
+    /** Failed looks for work in a row before a worker leaves a cycle */
+    static constexpr int idleSpinBudget = 256;
+
+private:
+    class Semaphore;
+    class Worker;
+    OwnedArray<WorkStealingDeque> deques;   ///< one per thread, 0 is the caller
+    OwnedArray<Worker> workers;
+    int maxTasks = 0;
+
+    std::unique_ptr<std::atomic<int>[]> remaining;  ///< unfinished dependencies per task
+    std::atomic<int> tasksLeft { 0 };
+    std::atomic<ProcessTaskGraph*> current { nullptr };
+    std::atomic<uint32> cycle { 0 };                ///< bumped by process before waking workers
+
+    void runUntilDone (int thread);
+    bool findTask (int thread, int& task);
+    void runTask (int thread, int task);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ProcessScheduler)
+};
+
+}
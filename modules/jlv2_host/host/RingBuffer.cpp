@@ -1,6 +1,4 @@
 /*
-    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
-
     This program is free software; you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
     the Free Software Foundation; either version 3 of the License, or
@@ -16,37 +14,39 @@
     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+
 namespace jlv2 {
 
 RingBuffer::RingBuffer (int32 capacity)
-    : fifo (1), buffer (nullptr)
 {
     setCapacity (capacity);
 }
 
 RingBuffer::~RingBuffer()
 {
-    fifo.reset();
-    fifo.setTotalSize (1);
-    buffer = nullptr;
+    data = nullptr;
+    capacity = mask = 0;
     block.free();
 }
 
 void RingBuffer::setCapacity (int32 newCapacity)
 {
-    newCapacity = nextPowerOfTwo (newCapacity);
+    newCapacity = nextPowerOfTwo (jmax (1, newCapacity));
 
-    if (fifo.getTotalSize() != newCapacity)
+    if ((int32) capacity != newCapacity)
     {
         HeapBlock<uint8> newBlock;
-        newBlock.allocate (newCapacity, true);
-        {
-            block.swapWith (newBlock);
-            buffer = block.getData();
-            fifo.setTotalSize (newCapacity);
-        }
+        newBlock.allocate ((size_t) newCapacity, true);
+        block.swapWith (newBlock);
+        data     = block.getData();
+        capacity = (uint32) newCapacity;
+        mask     = capacity - 1;
     }
 
-    fifo.reset();
+    writer.position.store (0, std::memory_order_relaxed);
+    writer.cached = 0;
+    reader.position.store (0, std::memory_order_relaxed);
+    reader.cached = 0;
 }
+
 }
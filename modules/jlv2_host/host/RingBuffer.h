@@ -14,24 +14,154 @@
     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+
 #pragma once
 
 namespace jlv2 {
 
-class RingBuffer
+/** A single producer, single consumer ring buffer of bytes.
+
+    One thread writes while another reads, without locks. Positions run
+    freely and are masked into a power of two sized buffer. Each side's
+    position lives on its own cache line along with a cached copy of the
+    other side's, so the two threads only touch shared lines when the
+    cache runs out.
+
+    reserve/commit and peek/consume hand out Spans pointing straight into
+    the buffer, so messages can be written and read in place. read and
+    write copy through them.
+ */
+class JLV2_API RingBuffer
 {
 public:
     RingBuffer (int32 capacity);
     ~RingBuffer();
 
+    struct Vector {
+        uint32 size;
+        void*  buffer;
+    };
+
+    /** A region of the buffer. It is split in two when it wraps around the
+        end, otherwise second is empty. An empty Span means the request
+        couldn't be met. */
+    struct Span
+    {
+        Vector first  { 0, nullptr };
+        Vector second { 0, nullptr };
+
+        inline uint32 getSize() const noexcept      { return first.size + second.size; }
+        inline bool isEmpty() const noexcept        { return getSize() == 0; }
+        inline bool isContiguous() const noexcept   { return second.size == 0; }
+
+        /** Copy bytes out of the span starting at offset */
+        inline void copyTo (void* dest, uint32 offset, uint32 bytes) const noexcept
+        {
+            jassert (offset + bytes <= getSize());
+            auto* out = static_cast<uint8*> (dest);
+            if (offset < first.size)
+            {
+                const uint32 n = jmin (bytes, first.size - offset);
+                memcpy (out, static_cast<const uint8*> (first.buffer) + offset, n);
+                out += n; bytes -= n; offset = 0;
+            }
+            else
+            {
+                offset -= first.size;
+            }
+
+            if (bytes > 0)
+                memcpy (out, static_cast<const uint8*> (second.buffer) + offset, bytes);
+        }
+
+        /** Copy bytes into the span starting at offset */
+        inline void copyFrom (const void* src, uint32 offset, uint32 bytes) noexcept
+        {
+            jassert (offset + bytes <= getSize());
+            auto* in = static_cast<const uint8*> (src);
+            if (offset < first.size)
+            {
+                const uint32 n = jmin (bytes, first.size - offset);
+                memcpy (static_cast<uint8*> (first.buffer) + offset, in, n);
+                in += n; bytes -= n; offset = 0;
+            }
+            else
+            {
+                offset -= first.size;
+            }
+
+            if (bytes > 0)
+                memcpy (static_cast<uint8*> (second.buffer) + offset, in, bytes);
+        }
+    };
+
+    /** Resize and empty the buffer. The capacity is rounded up to a power of two.
+        @note This is NOT realtime safe, and neither side may be in use
+     */
     void setCapacity (int32 newCapacity);
-    inline size_t size() const { return (size_t) fifo.getTotalSize(); }
+    inline size_t size() const { return (size_t) capacity; }
 
-    inline bool canRead  (uint32 bytes) const { return bytes <= (uint32) fifo.getNumReady() && bytes != 0; }
-    inline uint32 getReadSpace() const { return fifo.getNumReady(); }
+    //=========================================================================
+    /** Returns a span of bytes to write into, or an empty span if there
+        isn't room for all of them (producer, realtime) */
+    inline Span reserve (uint32 bytes) noexcept
+    {
+        const uint32 pos = writer.position.load (std::memory_order_relaxed);
+        if (bytes == 0 || bytes > capacity - (pos - writer.cached))
+        {
+            writer.cached = reader.position.load (std::memory_order_acquire);
+            if (bytes == 0 || bytes > capacity - (pos - writer.cached))
+                return Span();
+        }
 
-    inline bool canWrite (uint32 bytes) const { return bytes <= (uint32) fifo.getFreeSpace() && bytes != 0; }
-    inline uint32 getWriteSpace() const { return (uint32) fifo.getFreeSpace(); }
+        return makeSpan (pos, bytes);
+    }
+
+    /** Publish bytes written into a reserved span (producer, realtime) */
+    inline void commit (uint32 bytes) noexcept
+    {
+        const uint32 pos = writer.position.load (std::memory_order_relaxed);
+        jassert (bytes <= capacity - (pos - writer.cached));
+        writer.position.store (pos + bytes, std::memory_order_release);
+    }
+
+    /** Returns a span over the next bytes to read, or an empty span if
+        fewer are ready (consumer, realtime) */
+    inline Span peek (uint32 bytes) noexcept
+    {
+        const uint32 pos = reader.position.load (std::memory_order_relaxed);
+        if (bytes == 0 || bytes > reader.cached - pos)
+        {
+            reader.cached = writer.position.load (std::memory_order_acquire);
+            if (bytes == 0 || bytes > reader.cached - pos)
+                return Span();
+        }
+
+        return makeSpan (pos, bytes);
+    }
+
+    /** Release bytes that have been read (consumer, realtime) */
+    inline void consume (uint32 bytes) noexcept
+    {
+        const uint32 pos = reader.position.load (std::memory_order_relaxed);
+        jassert (bytes <= reader.cached - pos);
+        reader.position.store (pos + bytes, std::memory_order_release);
+    }
+
+    //=========================================================================
+    inline bool canRead  (uint32 bytes) const { return bytes <= getReadSpace() && bytes != 0; }
+    inline uint32 getReadSpace() const
+    {
+        return writer.position.load (std::memory_order_acquire)
+             - reader.position.load (std::memory_order_relaxed);
+    }
+
+    inline bool canWrite (uint32 bytes) const { return bytes <= getWriteSpace() && bytes != 0; }
+    inline uint32 getWriteSpace() const
+    {
+        return capacity - (writer.position.load (std::memory_order_relaxed)
+                         - reader.position.load (std::memory_order_acquire));
+    }
 
     inline uint32
     peak (void* dest, uint32 size)
@@ -39,30 +169,37 @@ public:
         return read (dest, size, false);
     }
 
-    inline void advance (uint32 bytes, bool write)
+    /** Skip bytes on the write or read side without copying. Returns false
+        and leaves the buffer alone if there isn't room, or not enough ready */
+    inline bool advance (uint32 bytes, bool write)
     {
         if (write)
-            fifo.finishedWrite (static_cast<int> (bytes));
+        {
+            if (reserve (bytes).isEmpty())
+                return false;
+            commit (bytes);
+        }
         else
-            fifo.finishedRead (static_cast<int> (bytes));
+        {
+            if (peek (bytes).isEmpty())
+                return false;
+            consume (bytes);
+        }
+
+        return true;
     }
 
     inline uint32
     read (void* dest, uint32 size, bool advance = true)
     {
-        buffer = block.getData();
-        fifo.prepareToRead (size, vec1.index, vec1.size, vec2.index, vec2.size);
-
-        if (vec1.size > 0)
-            memcpy (dest, buffer + vec1.index, vec1.size);
+        size = jmin (size, getReadSpace());
+        const Span span (peek (size));
+        span.copyTo (dest, 0, span.getSize());
 
-        if (vec2.size > 0)
-            memcpy ((uint8*) dest + vec1.size, buffer + vec2.index, vec2.size);
+        if (advance && ! span.isEmpty())
+            consume (span.getSize());
 
-        if (advance)
-            fifo.finishedRead (vec1.size + vec2.size);
-
-        return vec1.size + vec2.size;
+        return span.getSize();
     }
 
     template <typename T>
@@ -71,24 +208,22 @@ public:
         return read (&dest, sizeof (T), advance);
     }
 
-    inline void advanceReadPointer (const uint32) {
-        jassertfalse;
+    inline bool advanceReadPointer (const uint32 bytes)
+    {
+        return advance (bytes, false);
     }
 
     inline uint32
     write (const void* src, uint32 bytes)
     {
-        buffer = block.getData();
-        fifo.prepareToWrite (bytes, vec1.index, vec1.size, vec2.index, vec2.size);
-
-        if (vec1.size > 0)
-            memcpy (buffer + vec1.index, src, vec1.size);
+        bytes = jmin (bytes, getWriteSpace());
+        Span span (reserve (bytes));
+        span.copyFrom (src, 0, span.getSize());
 
-        if (vec2.size > 0)
-            memcpy (buffer + vec2.index, (uint8*)src + vec1.size, vec2.size);
+        if (! span.isEmpty())
+            commit (span.getSize());
 
-        fifo.finishedWrite (vec1.size + vec2.size);
-        return vec1.size + vec2.size;
+        return span.getSize();
     }
 
     template <typename T>
@@ -97,22 +232,40 @@ public:
         return write (&src, sizeof (T));
     }
 
-    struct Vector {
-        uint32 size;
-        void*  buffer;
-    };
-
 private:
-    struct Vec
+    enum { cacheLineSize = 64 };
+
+    /** One side's position and its cached copy of the other side's,
+        padded on both sides so nothing else shares their cache line */
+    struct Cursor
     {
-        int32 size;
-        int32 index;
+        uint8 before [cacheLineSize];
+        std::atomic<uint32> position { 0 };
+        uint32 cached = 0;
+        uint8 after [cacheLineSize - sizeof (uint32) - sizeof (std::atomic<uint32>)];
     };
 
-    Vec vec1, vec2;
-    AbstractFifo fifo;
     HeapBlock<uint8> block;
-    uint8* buffer;
+    uint8* data = nullptr;
+    uint32 capacity = 0;
+    uint32 mask = 0;
+
+    Cursor writer;      ///< producer position, caches the reader's
+    Cursor reader;      ///< consumer position, caches the writer's
+
+    inline Span makeSpan (uint32 pos, uint32 bytes) const noexcept
+    {
+        const uint32 index = pos & mask;
+        const uint32 first = jmin (bytes, capacity - index);
+
+        Span span;
+        span.first = { first, data + index };
+        if (bytes > first)
+            span.second = { bytes - first, data };
+        return span;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (RingBuffer)
 };
 
 }
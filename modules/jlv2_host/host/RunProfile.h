@@ -0,0 +1,53 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+/** Time spent in each phase of running a plugin, accumulated over calls
+    to Module::run in Time::getHighResolutionTicks() units. Whatever part
+    of total isn't in a phase is other host work, like sleep detection
+    and copying outputs back.
+ */
+struct RunProfile
+{
+    int64 events  = 0;      ///< draining control values and port events
+    int64 connect = 0;      ///< connecting ports and resetting sequences
+    int64 worker  = 0;      ///< worker responses and end_run
+    int64 plugin  = 0;      ///< inside lilv_instance_run
+    int64 total   = 0;      ///< all of Module::run
+    int64 runs    = 0;      ///< number of calls to Module::run
+
+    /** Reconnect every port on every run instead of only ports whose
+        location changed. Only for measuring what the connection cache saves. */
+    bool reconnectAll = false;
+
+    /** Clear all the counters, options are kept */
+    void reset() noexcept
+    {
+        const bool all = reconnectAll;
+        *this = RunProfile();
+        reconnectAll = all;
+    }
+
+    /** Returns the host's share of total */
+    int64 getHostTicks() const noexcept { return total - plugin; }
+};
+
+}
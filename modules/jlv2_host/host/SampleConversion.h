@@ -0,0 +1,66 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #define JLV2_USE_SSE2 1
+ #include <emmintrin.h>
+#else
+ #define JLV2_USE_SSE2 0
+#endif
+
+namespace jlv2 {
+
+/** Converts between double and float sample buffers (realtime) */
+struct SampleConversion
+{
+    /** Narrow num doubles to floats */
+    static void toFloat (float* dest, const double* src, int num) noexcept
+    {
+        int i = 0;
+       #if JLV2_USE_SSE2
+        for (; i + 4 <= num; i += 4)
+        {
+            const __m128 lo = _mm_cvtpd_ps (_mm_loadu_pd (src + i));
+            const __m128 hi = _mm_cvtpd_ps (_mm_loadu_pd (src + i + 2));
+            _mm_storeu_ps (dest + i, _mm_movelh_ps (lo, hi));
+        }
+       #endif
+        for (; i < num; ++i)
+            dest[i] = static_cast<float> (src[i]);
+    }
+
+    /** Widen num floats to doubles */
+    static void toDouble (double* dest, const float* src, int num) noexcept
+    {
+        int i = 0;
+       #if JLV2_USE_SSE2
+        for (; i + 4 <= num; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps (src + i);
+            _mm_storeu_pd (dest + i,     _mm_cvtps_pd (v));
+            _mm_storeu_pd (dest + i + 2, _mm_cvtps_pd (_mm_movehl_ps (v, v)));
+        }
+       #endif
+        for (; i < num; ++i)
+            dest[i] = static_cast<double> (src[i]);
+    }
+};
+
+}
@@ -24,12 +24,24 @@ namespace jlv2 {
 /** Maintains a map of Strings/Symbols to integers
     This class also implements LV2 URID Map/Unmap features and is fully
     compatible with the current LV2 (1.6.0+) specification.
+
+    Any number of threads may map and unmap at once. Looking up a symbol
+    that is already mapped, and unmapping, never lock or allocate, so
+    plugins can do either from their run function. Mapping a new symbol
+    takes a lock and copies it into storage that never moves, so the
+    strings returned by unmap stay valid until the map is cleared.
  */
 class SymbolMap
 {
 public:
     /** Create an empty symbol map and initialized LV2 URID features */
-    SymbolMap() = default;
+    SymbolMap()
+    {
+        for (auto& bucket : buckets)
+            bucket.store (nullptr, std::memory_order_relaxed);
+        for (auto& block : directory)
+            block.store (nullptr, std::memory_order_relaxed);
+    }
 
     ~SymbolMap()
     {
@@ -37,27 +49,29 @@ public:
     }
 
     /** Map a symbol/uri to an unsigned integer
+        Realtime safe if the symbol is already mapped.
         @param key The symbol to map
         @return A mapped URID, a return of 0 indicates failure */
     inline LV2_URID map (const char* key)
     {
-        if (! contains (key))
-        {
-            const uint32_t urid (1 + (LV2_URID) mapped.size());
-            mapped [key] = urid;
-            unmapped [urid] = std::string (key);
-            return urid;
-        }
+        if (key == nullptr)
+            return 0;
+
+        uint32 length;
+        const uint32 hash = hashOf (key, length);
+        if (const auto* entry = find (key, hash))
+            return entry->urid;
 
-        return mapped [key];
+        return insert (key, hash, length);
     }
 
     /** Containment test of a URI
         @param uri The URI to test
         @return True if found */
-    inline bool contains (const char* uri)
+    inline bool contains (const char* uri) const
     {
-        return mapped.find (uri) != mapped.end();
+        uint32 length;
+        return uri != nullptr && find (uri, hashOf (uri, length)) != nullptr;
     }
 
     /** Containment test of a URID
@@ -65,25 +79,35 @@ public:
         @return True if found */
     inline bool contains (LV2_URID urid) const
     {
-        return unmapped.find (urid) != unmapped.end();
+        return lookup (urid) != nullptr;
     }
 
-    /** Unmap an already mapped id to its symbol
+    /** Unmap an already mapped id to its symbol (realtime)
         @param urid The URID to unmap
-        @return The previously mapped symbol or 0 if the urid isn't in the cache */
-    inline const char* unmap (LV2_URID urid)
+        @return The previously mapped symbol or an empty string if the urid isn't in the cache */
+    inline const char* unmap (LV2_URID urid) const
     {
-        if (contains (urid))
-            return (const char*) unmapped [urid].c_str();
+        if (const auto* entry = lookup (urid))
+            return entry->symbol;
 
         return "";
     }
 
-    /** Clear the SymbolMap */
+    /** Returns the number of symbols mapped */
+    inline uint32 size() const { return numMapped.load (std::memory_order_acquire); }
+
+    /** Clear the SymbolMap
+        @note Not thread safe, nothing else may use the map meanwhile */
     inline void clear()
     {
-        mapped.clear();
-        unmapped.clear();
+        const ScopedLock sl (lock);
+        for (auto& bucket : buckets)
+            bucket.store (nullptr, std::memory_order_relaxed);
+        for (auto& block : directory)
+            delete[] block.exchange (nullptr, std::memory_order_relaxed);
+        numMapped.store (0, std::memory_order_release);
+        arena.clear();
+        arenaUsed = arenaSize = 0;
     }
 
     /** Create a URID Map LV2Feature. Thie created feature MUST be deleted
@@ -97,9 +121,125 @@ public:
 private:
     friend class MapFeature;
     friend class UnmapFeature;
-    typedef std::unordered_map<std::string, LV2_URID> Mapped;
-    typedef std::unordered_map<LV2_URID, std::string> Unmapped;
-    Mapped mapped; Unmapped unmapped;
+
+    /** A mapped symbol, immutable once published */
+    struct Entry
+    {
+        const Entry* next;      ///< next entry in the same bucket
+        uint32 hash;
+        LV2_URID urid;
+        char symbol[1];         ///< null terminated, allocated to fit
+    };
+
+    enum
+    {
+        numBuckets  = 4096,     ///< a power of two, chains grow past this many symbols
+        blockBits   = 10,       ///< URIDs per directory block, as a power of two
+        numBlocks   = 1024,     ///< so up to a million symbols
+        arenaBlock  = 64 * 1024
+    };
+
+    std::atomic<const Entry*> buckets [numBuckets];
+    std::atomic<std::atomic<const Entry*>*> directory [numBlocks];    ///< URID - 1 to entry
+    std::atomic<uint32> numMapped { 0 };
+
+    CriticalSection lock;                               ///< inserts and clear only
+    std::vector<std::unique_ptr<char[]>> arena;         ///< entry storage, never moves
+    size_t arenaUsed = 0, arenaSize = 0;
+
+    /** FNV-1a, also measures the string */
+    static uint32 hashOf (const char* key, uint32& length) noexcept
+    {
+        uint32 hash = 2166136261u;
+        const char* c = key;
+        for (; *c != 0; ++c)
+            hash = (hash ^ (uint8) *c) * 16777619u;
+        length = (uint32) (c - key);
+        return hash;
+    }
+
+    const Entry* find (const char* key, uint32 hash) const noexcept
+    {
+        for (auto* entry = buckets[hash & (numBuckets - 1)].load (std::memory_order_acquire);
+             entry != nullptr; entry = entry->next)
+        {
+            if (entry->hash == hash && std::strcmp (entry->symbol, key) == 0)
+                return entry;
+        }
+
+        return nullptr;
+    }
+
+    const Entry* lookup (LV2_URID urid) const noexcept
+    {
+        if (urid == 0 || urid > numMapped.load (std::memory_order_acquire))
+            return nullptr;
+
+        const uint32 index = urid - 1;
+        if (index >= (uint32) numBlocks << blockBits)
+            return nullptr;
+
+        const auto* block = directory[index >> blockBits].load (std::memory_order_acquire);
+        return block != nullptr ? block[index & ((1u << blockBits) - 1)].load (std::memory_order_acquire)
+                                : nullptr;
+    }
+
+    LV2_URID insert (const char* key, uint32 hash, uint32 length)
+    {
+        const ScopedLock sl (lock);
+
+        // someone may have mapped it while this waited for the lock
+        if (const auto* existing = find (key, hash))
+            return existing->urid;
+
+        const uint32 index = numMapped.load (std::memory_order_relaxed);
+        if (index >= (uint32) numBlocks << blockBits)
+        {
+            jassertfalse;   // out of URIDs
+            return 0;
+        }
+
+        auto& block = directory [index >> blockBits];
+
+        if (block.load (std::memory_order_relaxed) == nullptr)
+        {
+            auto* newBlock = new std::atomic<const Entry*> [1u << blockBits];
+            for (uint32 i = 0; i < (1u << blockBits); ++i)
+                newBlock[i].store (nullptr, std::memory_order_relaxed);
+            block.store (newBlock, std::memory_order_release);
+        }
+
+        auto* entry = static_cast<Entry*> (allocate (offsetof (Entry, symbol) + length + 1));
+        auto& bucket = buckets [hash & (numBuckets - 1)];
+        entry->next = bucket.load (std::memory_order_relaxed);
+        entry->hash = hash;
+        entry->urid = index + 1;
+        std::memcpy (entry->symbol, key, length + 1);
+
+        // readers find the entry by URID only once it is counted, and by
+        // symbol once it heads its bucket
+        block.load (std::memory_order_relaxed)[index & ((1u << blockBits) - 1)]
+            .store (entry, std::memory_order_release);
+        numMapped.store (index + 1, std::memory_order_release);
+        bucket.store (entry, std::memory_order_release);
+        return entry->urid;
+    }
+
+    /** Carve aligned storage out of the arena, call with the lock held */
+    void* allocate (size_t bytes)
+    {
+        bytes = (bytes + alignof (Entry) - 1) & ~(alignof (Entry) - 1);
+        if (arena.empty() || arenaUsed + bytes > arenaSize)
+        {
+            arenaSize = jmax (bytes, (size_t) arenaBlock);
+            arena.emplace_back (new char [arenaSize]);
+            arenaUsed = 0;
+        }
+
+        void* const result = arena.back().get() + arenaUsed;
+        arenaUsed += bytes;
+        return result;
+    }
 
     inline static LV2_URID _map (LV2_URID_Map_Handle handle, const char* uri)
     {
@@ -161,6 +301,8 @@ private:
 
         friend class SymbolMap;
     };
+
+    JUCE_DECLARE_NON_COPYABLE (SymbolMap)
 };
 
 }
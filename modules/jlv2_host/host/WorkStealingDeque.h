@@ -0,0 +1,121 @@
+/*
+    Copyright (c) 2014-2019  Michael Fisher <mfisher@kushview.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+namespace jlv2 {
+
+/** A fixed size Chase-Lev work stealing deque of task indexes.
+
+    The owning thread pushes and pops at the bottom, any other thread may
+    steal from the top. Nothing allocates once reset has been called.
+ */
+class WorkStealingDeque final
+{
+public:
+    WorkStealingDeque() { reset (16); }
+    ~WorkStealingDeque() = default;
+
+    /** Empty the deque and make room for at least capacity tasks
+        @note This is NOT realtime safe
+     */
+    void reset (int capacity)
+    {
+        const int size = nextPowerOfTwo (jmax (2, capacity));
+        if (size != mask + 1)
+        {
+            tasks.reset (new std::atomic<int> [(size_t) size]);
+            mask = size - 1;
+        }
+
+        top.store (0, std::memory_order_relaxed);
+        bottom.store (0, std::memory_order_relaxed);
+    }
+
+    /** Push a task, owner thread only (realtime).
+        Returns false if the deque is full */
+    bool push (int task) noexcept
+    {
+        const int64 b = bottom.load (std::memory_order_relaxed);
+        const int64 t = top.load (std::memory_order_acquire);
+        if (b - t > (int64) mask)
+            return false;
+
+        tasks [b & mask].store (task, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+        bottom.store (b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /** Pop the most recently pushed task, owner thread only (realtime) */
+    bool pop (int& task) noexcept
+    {
+        const int64 b = bottom.load (std::memory_order_relaxed) - 1;
+        bottom.store (b, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        int64 t = top.load (std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            bottom.store (b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        task = tasks [b & mask].load (std::memory_order_relaxed);
+        if (t == b)
+        {
+            // last one, race any thieves for it
+            const bool won = top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+                                                                    std::memory_order_relaxed);
+            bottom.store (b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    /** Take the oldest task, any thread (realtime) */
+    bool steal (int& task) noexcept
+    {
+        int64 t = top.load (std::memory_order_acquire);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        const int64 b = bottom.load (std::memory_order_acquire);
+        if (t >= b)
+            return false;
+
+        task = tasks [t & mask].load (std::memory_order_relaxed);
+        return top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+                                                      std::memory_order_relaxed);
+    }
+
+    /** Returns true if there was nothing to take when called, any thread */
+    bool isEmpty() const noexcept
+    {
+        return top.load (std::memory_order_acquire) >= bottom.load (std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<int64> top { 0 };
+    std::atomic<int64> bottom { 0 };
+    std::unique_ptr<std::atomic<int>[]> tasks;
+    int mask = -1;
+
+    JUCE_DECLARE_NON_COPYABLE (WorkStealingDeque)
+};
+
+}
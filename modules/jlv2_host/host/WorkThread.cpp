@@ -28,208 +28,530 @@
 
 namespace jlv2 {
 
-WorkThread::WorkThread (const String& name, uint32 bufsize, int32 priority)
-    : Thread (name)
+WorkerRegistry::WorkerRegistry()
 {
-    nextWorkId = 0;
-    bufferSize = (uint32) nextPowerOfTwo (bufsize);
-    requests   = new RingBuffer (bufferSize);
-    startThread (priority);
+    static_assert (maxWorkers == 1u << indexBits, "ids hold a slot index");
+
+    for (auto& chunk : chunks)
+        chunk.store (nullptr, std::memory_order_relaxed);
 }
 
-WorkThread::~WorkThread()
+WorkerRegistry::~WorkerRegistry()
 {
-    doExit = true;
-    signalThreadShouldExit();
-    notify();
-    waitForThreadToExit (100);
-    requests = nullptr;
+    for (auto& chunk : chunks)
+        delete[] chunk.load (std::memory_order_relaxed);
 }
 
-WorkerBase* WorkThread::getWorker (uint32 workerId) const
+WorkerRegistry::Slot* WorkerRegistry::getSlot (uint32 workId) const noexcept
 {
-    if (workerId == 0)
-        return nullptr;
-
-    for (int i = 0; i < workers.size(); ++i)
-        if (workers.getUnchecked(i)->workId == workerId)
-            return workers.getUnchecked (i);
-
+    const uint32 index = workId & (maxWorkers - 1);
+    if (auto* const chunk = chunks[index >> slotBits].load (std::memory_order_acquire))
+        return chunk + (index & (slotsPerChunk - 1));
     return nullptr;
 }
 
-void WorkThread::addWorker (WorkerBase* worker)
+uint32 WorkerRegistry::add (WorkerBase* worker)
 {
-    worker->workId = ++nextWorkId;
-    WORKER_LOG (getThreadName() + " registering worker: " + String (worker->workId));
-    workers.addIfNotAlreadyThere (worker);
+    const ScopedLock sl (lock);
+
+    uint32 index;
+    if (! freeSlots.isEmpty())
+    {
+        index = freeSlots.removeAndReturn (freeSlots.size() - 1);
+    }
+    else if (numSlots < maxWorkers)
+    {
+        index = numSlots++;
+        if ((index & (slotsPerChunk - 1)) == 0)
+            chunks[index >> slotBits].store (new Slot [slotsPerChunk], std::memory_order_release);
+    }
+    else
+    {
+        jassertfalse;
+        return 0;
+    }
+
+    auto& slot = chunks[index >> slotBits].load (std::memory_order_relaxed)[index & (slotsPerChunk - 1)];
+    uint32 generation = slot.state.load (std::memory_order_relaxed) >> 1;
+    if (generation == 0)
+        generation = 1;
+
+    slot.worker = worker;
+    slot.state.store (generation << 1, std::memory_order_release);
+    return (generation << indexBits) | index;
 }
 
-void WorkThread::removeWorker (WorkerBase* worker)
+void WorkerRegistry::remove (uint32 workId)
 {
-    WORKER_LOG (getThreadName() + " removing worker: " + String (worker->workId));
-    workers.removeFirstMatchingValue (worker);
-    worker->workId = 0;
+    auto* const slot = workId != 0 ? getSlot (workId) : nullptr;
+    if (slot == nullptr)
+        return;
+
+    const uint32 generation = workId >> indexBits;
+    uint32 next = (generation + 1) & generationMask;
+    if (next == 0)
+        next = 1;
+
+    // waits out a request in progress, then no thread can acquire it again
+    for (uint32 expected = generation << 1;
+         ! slot->state.compare_exchange_weak (expected, next << 1, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed);
+         expected = generation << 1)
+    {
+        if ((expected >> 1) != generation)
+        {
+            jassertfalse;   // already removed
+            return;
+        }
+
+        Thread::sleep (1);
+    }
+
+    const ScopedLock sl (lock);
+    slot->worker = nullptr;
+    freeSlots.add (workId & (maxWorkers - 1));
 }
 
-void WorkThread::run()
+WorkerBase* WorkerRegistry::acquire (uint32 workId) noexcept
 {
-    HeapBlock<uint8> buffer;
-    int32 readBufferSize = 0;
+    auto* const slot = workId != 0 ? getSlot (workId) : nullptr;
+    if (slot == nullptr)
+        return nullptr;
 
-    while (true)
+    const uint32 idle = (workId >> indexBits) << 1;
+    for (uint32 expected = idle;
+         ! slot->state.compare_exchange_weak (expected, idle | busy, std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+         expected = idle)
     {
-        this->wait (-1);
-        
-        if (doExit || threadShouldExit()) 
-            break;
+        if ((expected & ~(uint32) busy) != idle)
+            return nullptr;
 
-        while (! validateMessage (*requests))
-            Thread::sleep (6);
+        // another thread is letting go of it
+        Thread::yield();
+    }
 
-        if (doExit || threadShouldExit()) 
-            break;
+    return slot->worker;
+}
 
-        uint32 size = 0;
-        if (requests->read (&size, sizeof (size)) < sizeof (size))
-        {
-            WORKER_LOG ("error reading request: message size");
-            continue;
-        }
+void WorkerRegistry::release (uint32 workId) noexcept
+{
+    if (auto* const slot = getSlot (workId))
+        slot->state.fetch_and (~(uint32) busy, std::memory_order_release);
+}
 
-        uint32 workId;
-        if (requests->read (&workId, sizeof (workId)) < sizeof (workId))
-        {
-            WORKER_LOG ("error reading request: worker id");
-            continue;
-        }
+//=============================================================================
+class WorkerPool::WorkThread final : public Thread
+{
+public:
+    WorkThread (WorkerPool& p, int i)
+        : Thread ("lv2_worker_" + String (i + 1)),
+          pool (p), index (i),
+          inbox (WorkerRegistry::maxWorkers * MultiProducerQueue<uint32>::getFrameSize (0))
+    {
+        queue.reset ((int) WorkerRegistry::maxWorkers);
+    }
 
-        if (workId == 0)
-            continue;
+    ~WorkThread()
+    {
+        signalThreadShouldExit();
+        notify();
+        stopThread (1000);
+    }
 
-        if (size > static_cast<uint32> (readBufferSize))
+    /** Queue a worker on this thread, any thread (realtime) */
+    bool post (uint32 workId) noexcept
+    {
+        depth.fetch_add (1, std::memory_order_relaxed);
+        if (! inbox.write (workId))
         {
-			readBufferSize = nextPowerOfTwo (size);
-            buffer.realloc (readBufferSize);
+            depth.fetch_sub (1, std::memory_order_relaxed);
+            return false;
         }
 
-        if (requests->read (buffer.getData(), size) < size)
+        wake();
+        return true;
+    }
+
+    /** Put a worker back at the end of this thread's queue, this thread only */
+    void requeue (uint32 workId) noexcept
+    {
+        depth.fetch_add (1, std::memory_order_relaxed);
+        if (! queue.push ((int) workId))
         {
-            WORKER_LOG ("error reading request: message body");
-            continue;
+            jassertfalse;   // can't happen, each worker is queued at most once
+            depth.fetch_sub (1, std::memory_order_relaxed);
         }
+    }
+
+    /** Take the oldest worker queued here, any thread */
+    bool steal (uint32& workId) noexcept
+    {
+        int task;
+        if (! queue.steal (task))
+            return false;
+
+        depth.fetch_sub (1, std::memory_order_relaxed);
+        workId = (uint32) task;
+        return true;
+    }
+
+    /** Signal the thread, at most once until it next wakes (realtime) */
+    void wake() noexcept
+    {
+        if (! wakePending.exchange (true, std::memory_order_acq_rel))
+            notify();
+    }
+
+    int getDepth() const noexcept { return depth.load (std::memory_order_relaxed); }
 
+    void run() override
+    {
+        while (! threadShouldExit())
         {
-            if (WorkerBase* const worker = getWorker (workId))
+            wait (-1);
+
+            // anything posted from here on needs a new wake up
+            wakePending.exchange (false, std::memory_order_acq_rel);
+
+            while (! threadShouldExit())
             {
-                while (! worker->flag.setWorking (true)) {}
-                worker->processRequest (size, buffer.getData());
-                while (! worker->flag.setWorking (false)) {}
+                takeInbox();
+
+                // everyone takes the oldest worker, so workers are served in
+                // the order they were queued
+                uint32 workId;
+                if (steal (workId))
+                {
+                    if (! queue.isEmpty())
+                        pool.wakeIdleThread (index);
+                    pool.runWorker (workId, index);
+                }
+                else if (! queue.isEmpty())
+                {
+                    continue;   // lost a race for the oldest, try again
+                }
+                else if (! pool.stealWorker (index, workId))
+                {
+                    break;
+                }
+                else
+                {
+                    pool.runWorker (workId, index);
+                }
             }
         }
+    }
+
+private:
+    WorkerPool& pool;
+    const int index;
+    MultiProducerQueue<uint32> inbox;       ///< workers scheduled on this thread
+    WorkStealingDeque queue;                ///< workers taken from the inbox, others may steal
+    std::atomic<int> depth { 0 };           ///< workers in the inbox and queue
+    std::atomic<bool> wakePending { false };
 
-        if (threadShouldExit() || doExit)
-            break;
+    void takeInbox()
+    {
+        inbox.readAll ([this] (uint32 workId, const void*, uint32) {
+            if (! queue.push ((int) workId))
+                jassertfalse;   // can't happen, each worker is queued at most once
+        });
     }
 
-    buffer.free();
-}
+    JUCE_DECLARE_NON_COPYABLE (WorkThread)
+};
 
+//=============================================================================
+WorkerPool::WorkerPool (int numThreads, int32 threadPriority)
+    : priority (threadPriority)
+{
+    setNumThreads (numThreads);
+}
 
-bool WorkThread::scheduleWork (WorkerBase* worker, uint32 size, const void* data)
+WorkerPool::~WorkerPool()
 {
-    jassert (size > 0 && worker && worker->workId != 0);
-    if (! requests->canWrite (getRequiredSpace (size)))
-        return false;
+    // threads steal from each other, so all of them stop before any is deleted
+    const int count = numCreated.load (std::memory_order_acquire);
+    for (int i = 0; i < count; ++i)
+    {
+        threads[i]->signalThreadShouldExit();
+        threads[i]->notify();
+    }
 
-    if (requests->write (&size, sizeof(size)) < sizeof (uint32))
-        return false;
+    for (int i = 0; i < count; ++i)
+        threads[i]->stopThread (1000);
 
-    if (requests->write (&worker->workId, sizeof (worker->workId)) < sizeof (worker->workId))
-        return false;
+    for (auto& thread : threads)
+        thread = nullptr;
+}
 
-    if (requests->write (data, size) < size)
-        return false;
+void WorkerPool::setNumThreads (int newNumThreads)
+{
+    const ScopedLock sl (lock);
+    newNumThreads = jlimit (1, (int) maxThreads, newNumThreads);
 
-    notify();
-    return true;
+    while (numCreated.load (std::memory_order_relaxed) < newNumThreads)
+    {
+        const int index = numCreated.load (std::memory_order_relaxed);
+        threads[index].reset (new WorkThread (*this, index));
+        threads[index]->startThread (priority);
+        numCreated.store (index + 1, std::memory_order_release);
+    }
+
+    numActive.store (newNumThreads, std::memory_order_release);
 }
 
-bool WorkThread::validateMessage (RingBuffer& ring)
+int WorkerPool::getQueueDepth (int thread) const noexcept
 {
-    uint32 size = 0;
-    ring.peak (&size, sizeof (size));
-    return ring.canRead (getRequiredSpace (size));
+    const int count = numCreated.load (std::memory_order_acquire);
+    if (thread >= 0)
+        return thread < count ? threads[thread]->getDepth() : 0;
+
+    int depth = 0;
+    for (int i = 0; i < count; ++i)
+        depth += threads[i]->getDepth();
+    return depth;
 }
 
-WorkerBase::WorkerBase (WorkThread& thread, uint32 bufsize)
-    : owner (thread)
+void WorkerPool::addWorker (WorkerBase* worker)
 {
-    responses = new RingBuffer (bufsize);
-    response.calloc (bufsize);
-    thread.addWorker (this);
+    worker->workId = workers.add (worker);
+    WORKER_LOG ("registering worker: " + String (worker->workId));
 }
 
-WorkerBase::~WorkerBase()
+void WorkerPool::removeWorker (WorkerBase* worker)
 {
-    while (flag.isWorking()) {
-        Thread::sleep (100);
+    WORKER_LOG ("removing worker: " + String (worker->workId));
+    workers.remove (worker->workId);
+    worker->workId = 0;
+}
+
+void WorkerPool::scheduleWorker (WorkerBase& worker)
+{
+    // pairs with the fence in runWorker, so either the thread running the
+    // worker sees the new request or this queues the worker again
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (worker.queued.exchange (true, std::memory_order_acq_rel))
+        return;
+
+    // stay on the last thread unless another has less waiting
+    const int active = numActive.load (std::memory_order_acquire);
+    int best = worker.lastThread.load (std::memory_order_relaxed);
+    if (! isPositiveAndBelow (best, active))
+        best = 0;
+
+    int bestDepth = threads[best]->getDepth();
+    for (int i = 0; i < active && bestDepth > 0; ++i)
+    {
+        const int depth = threads[i]->getDepth();
+        if (depth < bestDepth)
+        {
+            best = i;
+            bestDepth = depth;
+        }
     }
 
-    owner.removeWorker (this);
-    responses = nullptr;
-    response.free();
+    if (! threads[best]->post (worker.workId))
+    {
+        jassertfalse;   // can't happen, inboxes hold every worker
+        worker.queued.store (false, std::memory_order_release);
+    }
 }
 
-bool WorkerBase::scheduleWork (uint32 size, const void* data)
+void WorkerPool::runWorker (uint32 workId, int thread)
 {
-    return owner.scheduleWork (this, size, data);
+    auto* const worker = workers.acquire (workId);
+    if (worker == nullptr)
+    {
+        WORKER_LOG ("dropped requests for removed worker: " + String (workId));
+        return;
+    }
+
+    worker->lastThread.store (thread, std::memory_order_relaxed);
+
+    const int depth = worker->isTiming() ? getQueueDepth() : 0;
+
+    while (! worker->flag.setWorking (true)) {}
+    const uint32 count = worker->requests->readAll ([=] (const WorkTimes& request, const void* data, uint32 size) {
+        worker->runRequest (request, size, data, thread, depth);
+    });
+    processed.fetch_add (count, std::memory_order_relaxed);
+
+    // requests scheduled while this ran didn't queue the worker, so check
+    // for them and queue it again here
+    worker->queued.store (false, std::memory_order_seq_cst);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    const bool again = ! worker->requests->isEmpty()
+                    && ! worker->queued.exchange (true, std::memory_order_acq_rel);
+
+    // still working until the requests are left alone, see setSize
+    while (! worker->flag.setWorking (false)) {}
+    workers.release (workId);
+    if (again)
+        threads[thread]->requeue (workId);
 }
 
-bool WorkerBase::respondToWork (uint32 size, const void* data)
+bool WorkerPool::stealWorker (int thief, uint32& workId)
 {
-    if (! responses->canWrite (sizeof (size) + size))
+    // threads out of use only finish their own queues
+    if (thief >= numActive.load (std::memory_order_acquire))
         return false;
 
-    if (responses->write (&size, sizeof (size)) < sizeof (size))
-        return false;
+    const int count = numCreated.load (std::memory_order_acquire);
+    for (int i = 1; i < count; ++i)
+    {
+        if (threads[(thief + i) % count]->steal (workId))
+        {
+            steals.fetch_add (1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkerPool::wakeIdleThread (int busy)
+{
+    const int active = numActive.load (std::memory_order_acquire);
+    for (int i = 1; i < active; ++i)
+    {
+        auto& thread = *threads[(busy + i) % active];
+        if (thread.getDepth() == 0)
+        {
+            thread.wake();
+            return;
+        }
+    }
+}
+
+//=============================================================================
+WorkerBase::WorkerBase (WorkerPool& pool, uint32 bufsize)
+    : owner (pool)
+{
+    requests  = new MessageQueue<WorkTimes> (bufsize);
+    responses = new MessageQueue<WorkTimes> (bufsize);
+    pool.addWorker (this);
+}
+
+WorkerBase::~WorkerBase()
+{
+    detach();
+    requests  = nullptr;
+    responses = nullptr;
+}
 
-    if (responses->write (data, size) < size)
+void WorkerBase::detach()
+{
+    if (workId == 0)
+        return;
+
+    // waits for the pool to finish any request it is processing
+    owner.removeWorker (this);
+
+    while (flag.isWorking()) {
+        Thread::sleep (1);
+    }
+}
+
+bool WorkerBase::scheduleWork (uint32 size, const void* data)
+{
+    WorkTimes request;
+    if (isTiming())
+        request.scheduled = Time::getHighResolutionTicks();
+
+    // requests queued before going synchronous run first, so until the pool
+    // has drained them and let go of the worker new ones queue behind them
+    if (isSynchronous() && ! queued.load (std::memory_order_acquire)
+         && requests->isEmpty() && flag.setWorking (true))
+    {
+        runRequest (request, size, data, -1, 0);
+        while (! flag.setWorking (false)) {}
+        return true;
+    }
+
+    jassert (size > 0 && workId != 0);
+    if (workId == 0 || ! requests->write (request, data, size))
         return false;
 
+    owner.scheduleWorker (*this);
     return true;
 }
 
-void WorkerBase::processWorkResponses()
+void WorkerBase::runRequest (const WorkTimes& request, uint32 size, const void* data,
+                             int thread, int depth)
 {
-    uint32 remaining = responses->getReadSpace();
-    uint32 size      = 0;
+    current = request;
+    if (current.scheduled != 0)
+    {
+        current.started = Time::getHighResolutionTicks();
+        current.thread  = thread;
+        current.depth   = depth;
+    }
 
-    while (remaining >= sizeof (uint32))
+    processRequest (size, data);
+
+    if (current.scheduled != 0)
     {
-        /* respond next cycle if response isn't ready */
-        if (! validateMessage (*responses))
-            return;
+        current.finished = Time::getHighResolutionTicks();
+        requestFinished (current);
+    }
+
+    current = WorkTimes();
+}
 
-        responses->read (&size, sizeof (size));
-        responses->read (response.getData(), size);
-        processResponse (size, response.getData());
-        remaining -= (sizeof (uint32) + size);
+bool WorkerBase::respondToWork (uint32 size, const void* data)
+{
+    WorkTimes response;
+    if (current.scheduled != 0)
+    {
+        response = current;
+        response.finished  = 0;
+        response.responded = Time::getHighResolutionTicks();
     }
+
+    return responses->write (response, data, size);
 }
 
-bool WorkerBase::validateMessage (RingBuffer& ring)
+uint32 WorkerBase::processWorkResponses()
 {
-    // the worker only validates message size
-    uint32 size = 0;
-    ring.peak (&size, sizeof(size));
-    return ring.canRead (size + sizeof(size));
+    return responses->readAll ([this] (const WorkTimes& response, const void* data, uint32 size) {
+        processResponse (size, data);
+
+        if (response.scheduled != 0)
+        {
+            WorkTimes times (response);
+            times.delivered = Time::getHighResolutionTicks();
+            responseDelivered (times);
+        }
+    });
+}
+
+void WorkerBase::waitUntilIdle()
+{
+    while (queued.load (std::memory_order_acquire) || flag.isWorking()) {
+        Thread::sleep (1);
+    }
 }
 
 void WorkerBase::setSize (uint32 newSize)
 {
-    responses = new RingBuffer (newSize);
-    response.realloc (newSize);
+    // a queued worker is still referenced by a pool thread
+    waitUntilIdle();
+
+    requests->setCapacity (newSize);
+    responses->setCapacity (newSize);
+}
+
+uint32 WorkerBase::getSize() const
+{
+    return requests->getCapacity();
+}
+
+uint32 WorkerBase::getSizeForMessage (uint32 messageSize)
+{
+    // getMaxPayloadSize is about half the capacity
+    return 2 * MessageQueue<WorkTimes>::getFrameSize (messageSize);
 }
 
 }
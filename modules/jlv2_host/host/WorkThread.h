@@ -22,46 +22,156 @@ namespace jlv2 {
 
 class WorkerBase;
 
-/** A worker thread
-    Capable of scheduling non-realtime work from a realtime context.
+/** Maps worker ids to workers without locking the lookup.
+
+    Each worker gets a slot, and its id is the slot index tagged with the
+    slot's generation. Removing a worker bumps the generation, so ids of
+    removed workers, including ones still queued, never resolve, even
+    after the slot is reused. A thread resolving an id marks the slot busy
+    in the same atomic operation, and removal waits until it is released.
+    The worker can't be deleted while it's being used.
  */
-class WorkThread :  public Thread
+class WorkerRegistry
 {
 public:
-    WorkThread (const String& name, uint32 bufsize, int32 priority = 5);
-    ~WorkThread();
+    /** The most workers that can be registered at once */
+    enum : uint32 { maxWorkers = 1u << 12 };
 
-    inline static uint32 getRequiredSpace (uint32 msgSize) { return msgSize + (2 * sizeof (uint32)); }
+    WorkerRegistry();
+    ~WorkerRegistry();
 
-protected:
+    /** Register a worker and return its id, or 0 if the registry is full
+        @note This is NOT realtime safe
+     */
+    uint32 add (WorkerBase* worker);
+
+    /** Retire an id, waiting for any thread using its worker to release it
+        @note This is NOT realtime safe
+     */
+    void remove (uint32 workId);
+
+    /** Resolve an id and mark its worker busy. Returns nullptr if the worker
+        was removed. If another thread has it, waits for that thread to
+        release it. Call release when done with a non-null result. */
+    WorkerBase* acquire (uint32 workId) noexcept;
+
+    /** Release a worker returned by acquire */
+    void release (uint32 workId) noexcept;
+
+private:
+    enum : uint32 {
+        slotBits        = 6,
+        chunkBits       = 6,
+        indexBits       = slotBits + chunkBits,
+        slotsPerChunk   = 1u << slotBits,
+        numChunks       = 1u << chunkBits,
+        generationMask  = (1u << (32 - indexBits)) - 1,
+        busy            = 1u
+    };
+
+    /** state is the generation shifted up by one, low bit set while busy */
+    struct Slot
+    {
+        WorkerBase* worker = nullptr;
+        std::atomic<uint32> state { 0 };
+    };
+
+    std::atomic<Slot*> chunks [numChunks];  ///< allocated as slots are first used
+    Array<uint32> freeSlots;
+    uint32 numSlots = 0;
+    CriticalSection lock;                   ///< add and remove only
+
+    Slot* getSlot (uint32 workId) const noexcept;
+
+    JUCE_DECLARE_NON_COPYABLE (WorkerRegistry)
+};
+
+/** A pool of threads which run non-realtime work scheduled from realtime
+    contexts.
+
+    Each worker has its own request queue. When a worker gets work while
+    idle, its id is queued on the least loaded thread. Each thread has its
+    own queue of worker ids, and idle threads steal from busy ones, so one
+    slow worker can't hold up the others. A worker is only ever queued
+    once and run by one thread at a time, so its requests are processed
+    in the order they were scheduled, as the LV2 worker spec requires.
+ */
+class WorkerPool final
+{
+public:
+    /** Create a pool with a number of threads */
+    WorkerPool (int numThreads, int32 priority = 5);
+    ~WorkerPool();
+
+    /** The most threads a pool can have */
+    enum { maxThreads = 32 };
+
+    /** Change the number of threads that take new work. Threads taken out
+        of use finish what was queued on them and then sit idle until
+        they're needed again.
+        @note This is NOT realtime safe
+     */
+    void setNumThreads (int numThreads);
+
+    /** Returns the number of threads taking new work */
+    int getNumThreads() const noexcept      { return numActive.load (std::memory_order_acquire); }
+
+    /** Returns the number of workers waiting for a thread, on one thread
+        or all of them if thread is negative */
+    int getQueueDepth (int thread = -1) const noexcept;
+
+    /** Returns the number of times a thread took work queued on another */
+    int64 getNumSteals() const noexcept     { return steals.load (std::memory_order_relaxed); }
+
+    /** Returns the number of requests processed */
+    int64 getNumProcessed() const noexcept  { return processed.load (std::memory_order_relaxed); }
+
+private:
     friend class WorkerBase;
+    class WorkThread;
 
     /** Register a worker for scheduling. Does not take ownership */
     void addWorker (WorkerBase* worker);
 
-    /** Deregister a worker from scheduling. Does not delete the worker */
+    /** Deregister a worker, waiting for it to finish any request in progress */
     void removeWorker (WorkerBase* worker);
 
-    /** Schedule non-realtime work
-        Workers will call this in Worker::scheduleWork */
-    bool scheduleWork (WorkerBase* worker, uint32 size, const void* data);
+    /** Queue a worker which has requests waiting (realtime) */
+    void scheduleWorker (WorkerBase& worker);
 
-private:
-    uint32 bufferSize;
+    /** Process a worker's requests, on one of the pool's threads */
+    void runWorker (uint32 workId, int thread);
 
-    WorkerBase* getWorker (uint32 workerId) const;
-    Array<WorkerBase*, CriticalSection> workers;
+    /** Take a worker queued on another thread, returns false if none are */
+    bool stealWorker (int thief, uint32& workId);
 
-    uint32 nextWorkId;
-    bool doExit = false;
+    /** Wake a thread with nothing queued so it can steal from a busy one */
+    void wakeIdleThread (int busy);
 
-    ScopedPointer<RingBuffer> requests;  ///< requests to process
+    WorkerRegistry workers;
+    std::unique_ptr<WorkThread> threads [maxThreads];
+    std::atomic<int> numActive { 0 };
+    std::atomic<int> numCreated { 0 };
+    int32 priority;
+    CriticalSection lock;           ///< changes to the thread count
 
-    /** @internal Validate a ringbuffer for message completeness */
-    bool validateMessage (RingBuffer& ring);
+    std::atomic<int64> steals { 0 }, processed { 0 };
 
-    /** @internal The work thread function */
-    void run();
+    JUCE_DECLARE_NON_COPYABLE (WorkerPool)
+};
+
+/** When a worker request or its response reached each stage, in
+    Time::getHighResolutionTicks() units. Stages not reached yet are 0,
+    and scheduled is 0 when the worker wasn't timing. */
+struct WorkTimes
+{
+    int64 scheduled = 0;    ///< the plugin scheduled the request
+    int64 started   = 0;    ///< processing started
+    int64 finished  = 0;    ///< processing finished, requests only
+    int64 responded = 0;    ///< the response was sent, responses only
+    int64 delivered = 0;    ///< the response reached the plugin, responses only
+    int32 thread    = -1;   ///< the pool thread, -1 when run inline
+    int32 depth     = 0;    ///< workers waiting in the pool when processing started
 };
 
 /** A flag that indicates whether work is happening or not */
@@ -74,16 +184,17 @@ public:
 private:
     Atomic<int32> flag;
     inline bool setWorking (bool status) { return flag.compareAndSetBool (status ? 1 : 0, status ? 0 : 1); }
-    friend class WorkThread;
+    friend class WorkerPool;
+    friend class WorkerBase;
 };
 
 class WorkerBase
 {
 public:
     /** Create a new Worker
-        @param thread The WorkThread to use when scheduling
-        @param bufsize Size to use for internal response buffers */
-    WorkerBase (WorkThread& thread, uint32 bufsize);
+        @param pool The WorkerPool to use when scheduling
+        @param bufsize Size to use for internal request and response buffers */
+    WorkerBase (WorkerPool& pool, uint32 bufsize);
     virtual ~WorkerBase();
 
     /** Returns true if the worker is currently working */
@@ -101,12 +212,51 @@ public:
 
     /** Deliver pending responses (realtime thread)
         This must be called regularly from the realtime thread. For each read
-        response, Worker::processResponse will be called */
-    void processWorkResponses();
-
-    /** Set the internal buffer size for responses */
+        response, Worker::processResponse will be called.
+        Returns the number of responses delivered */
+    uint32 processWorkResponses();
+
+    /** Set the internal buffer size for requests and responses. Waits for
+        the pool to finish with this worker, then drops anything pending.
+        @note This is NOT realtime safe, and the realtime thread must not be
+              scheduling work or delivering responses meanwhile
+     */
     void setSize (uint32 newSize);
 
+    /** Returns the size of the request and response buffers */
+    uint32 getSize() const;
+
+    /** Returns the buffer size needed to always accept a message of this size */
+    static uint32 getSizeForMessage (uint32 messageSize);
+
+    /** Run work inline instead of on the work thread.
+        While synchronous, scheduleWork calls processRequest right away on
+        the calling thread, so responses are ready for the next call to
+        processWorkResponses. Use this for offline rendering.
+
+        Requests still queued when switching keep their order: new ones
+        queue behind them until the pool has drained the worker, rather
+        than running inline ahead of them. Call waitUntilIdle after
+        switching to be sure the next request runs inline.
+      */
+    void setSynchronous (bool synchronous) { sync.set (synchronous ? 1 : 0); }
+
+    /** Returns true if work runs inline */
+    bool isSynchronous() const { return sync.get() != 0; }
+
+    /** Wait until the pool has run every queued request and let go of
+        this worker.
+        @note This is NOT realtime safe
+     */
+    void waitUntilIdle();
+
+    /** Time requests and responses as they pass through the worker.
+        @see requestFinished, responseDelivered */
+    void setTiming (bool timing) { timed.store (timing, std::memory_order_relaxed); }
+
+    /** Returns true if requests and responses are timed */
+    bool isTiming() const { return timed.load (std::memory_order_relaxed); }
+
 protected:
     /** Process work (worker thread) */
     virtual void processRequest (uint32 size, const void* data) = 0;
@@ -114,17 +264,34 @@ protected:
     /** Process work responses (realtime thread) */
     virtual void processResponse (uint32 size, const void* data) = 0;
 
+    /** Called after processRequest for a timed request (worker thread) */
+    virtual void requestFinished (const WorkTimes&) {}
+
+    /** Called after processResponse for a timed response (realtime thread) */
+    virtual void responseDelivered (const WorkTimes&) {}
+
+    /** Take this worker out of the pool, waiting for any request in progress.
+        Subclasses call this first thing in their destructor, so the pool
+        never calls into a half destroyed worker. Safe to call twice. */
+    void detach();
+
 private:
-    WorkThread& owner;
-    uint32 workId;                       ///< The thread assigned id for this worker
+    WorkerPool& owner;
+    uint32 workId;                       ///< The pool assigned id for this worker
     WorkFlag flag;                       ///< A flag for when work is being processed
+    Atomic<int> sync;                    ///< non-zero to run work inline
+    std::atomic<bool> queued { false };  ///< true from scheduling until a thread has drained the requests
+    std::atomic<int> lastThread { -1 };  ///< the thread that last ran this worker
+    std::atomic<bool> timed { false };   ///< true to time requests and responses
+    WorkTimes current;                   ///< the request being processed
 
-    ScopedPointer<RingBuffer> responses; ///< responses from work
-    HeapBlock<uint8>          response;  ///< buffer to write a response
+    ScopedPointer<MessageQueue<WorkTimes>> requests;  ///< work to do
+    ScopedPointer<MessageQueue<WorkTimes>> responses; ///< responses from work
 
-    bool validateMessage (RingBuffer& ring);
+    void runRequest (const WorkTimes& request, uint32 size, const void* data,
+                     int thread, int depth);
 
-    friend class WorkThread;
+    friend class WorkerPool;
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WorkerBase);
 };
 
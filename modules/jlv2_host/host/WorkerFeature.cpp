@@ -24,7 +24,11 @@ namespace LV2Callbacks
     {
         WorkerFeature* worker = reinterpret_cast<WorkerFeature*> (handle);
         if (! worker->scheduleWork (size, data))
+        {
+            if (auto* stats = worker->getStats())
+                stats->addDroppedWorkRequest();
             return LV2_WORKER_ERR_NO_SPACE;
+        }
         return LV2_WORKER_SUCCESS;
     }
 
@@ -32,15 +36,19 @@ namespace LV2Callbacks
     {
         WorkerFeature* worker = reinterpret_cast<WorkerFeature*> (handle);
         if (! worker->respondToWork (size, data))
+        {
+            if (auto* stats = worker->getStats())
+                stats->addDroppedWorkResponse();
             return LV2_WORKER_ERR_NO_SPACE;
+        }
         return LV2_WORKER_SUCCESS;
     }
 }
 
-WorkerFeature::WorkerFeature (WorkThread& thread, uint32 bufsize,
+WorkerFeature::WorkerFeature (WorkerPool& pool, uint32 bufsize,
                       LV2_Handle handle,
                       LV2_Worker_Interface* iface)
-    : WorkerBase (thread, bufsize)
+    : WorkerBase (pool, bufsize)
 {
     setInterface (handle, iface);
 
@@ -53,6 +61,7 @@ WorkerFeature::WorkerFeature (WorkThread& thread, uint32 bufsize,
 
 WorkerFeature::~WorkerFeature()
 {
+    detach();
     plugin = nullptr;
     worker = nullptr;
     zerostruct (feat);
@@ -81,6 +90,38 @@ void WorkerFeature::processResponse (uint32 size, const void* responseData)
     worker->work_response (plugin, size, responseData);
 }
 
+void WorkerFeature::setTracing (bool shouldTrace)
+{
+    // created once and kept, so the worker and audio threads never see it go
+    if (shouldTrace && trace == nullptr)
+        trace.reset (new MultiProducerQueue<WorkTimes> (
+            traceCapacity * MultiProducerQueue<WorkTimes>::getFrameSize (0)));
+    tracing.store (shouldTrace, std::memory_order_release);
+}
+
+void WorkerFeature::requestFinished (const WorkTimes& times)
+{
+    if (stats != nullptr)
+        stats->addWorkRequest (toNanos (times.started - times.scheduled),
+                               toNanos (times.finished - times.started));
+    if (tracing.load (std::memory_order_acquire))
+        trace->write (times);
+}
+
+void WorkerFeature::responseDelivered (const WorkTimes& times)
+{
+    if (stats != nullptr)
+        stats->addWorkResponse (toNanos (times.delivered - times.responded),
+                                toNanos (times.delivered - times.scheduled));
+    if (tracing.load (std::memory_order_acquire))
+        trace->write (times);
+}
+
+uint64 WorkerFeature::toNanos (int64 ticks) const
+{
+    return (uint64) jmax (0.0, (double) ticks * nanosPerTick);
+}
+
 void WorkerFeature::endRun()
 {
     jassert (worker != nullptr && plugin != nullptr);
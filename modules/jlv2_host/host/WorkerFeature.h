@@ -24,7 +24,7 @@ class WorkerFeature final : public LV2Feature,
                             public WorkerBase
 {
 public:
-    WorkerFeature (WorkThread& thread, uint32 bufsize,
+    WorkerFeature (WorkerPool& pool, uint32 bufsize,
                    LV2_Handle handle = nullptr,
                    LV2_Worker_Interface* iface = nullptr);
 
@@ -32,17 +32,53 @@ public:
 
     void setInterface (LV2_Handle handle, LV2_Worker_Interface* iface);
 
+    /** Set where requests and responses that don't fit are counted */
+    void setStats (ModuleStats* newStats) { stats = newStats; }
+
+    /** Returns the stats drops are counted in, may be null */
+    ModuleStats* getStats() const { return stats; }
+
+    /** Also record timed requests and responses as trace events, for
+        readTrace. Timing has to be on for anything to be recorded.
+        @note This is NOT realtime safe
+     */
+    void setTracing (bool tracing);
+
+    /** Returns true if trace events are recorded */
+    bool isTracing() const { return tracing.load (std::memory_order_relaxed); }
+
+    /** Take the trace events recorded so far, oldest first, calling
+        fn (const WorkTimes&) for each. Events recorded while the trace is
+        full are lost. Only read from one thread at a time.
+     */
+    template <typename Callback>
+    uint32 readTrace (Callback&& fn)
+    {
+        if (trace == nullptr)
+            return 0;
+        return trace->readAll ([&fn] (const WorkTimes& times, const void*, uint32) { fn (times); });
+    }
+
     const String& getURI() const;
     const LV2_Feature* getFeature() const;
 
     void endRun();
     void processRequest (uint32 size, const void* data);
     void processResponse (uint32 size, const void* data);
+    void requestFinished (const WorkTimes& times);
+    void responseDelivered (const WorkTimes& times);
 
 private:
+    enum { traceCapacity = 4096 };      ///< events held until readTrace
     String uri;
     LV2_Worker_Interface* worker;
     LV2_Handle plugin;
+    ModuleStats* stats = nullptr;
+    std::unique_ptr<MultiProducerQueue<WorkTimes>> trace;
+    std::atomic<bool> tracing { false };
+    const double nanosPerTick = 1.0e9 / (double) Time::getHighResolutionTicksPerSecond();
+
+    uint64 toNanos (int64 ticks) const;
     LV2_Worker_Schedule data;
     LV2_Feature feat;
 };
@@ -20,13 +20,19 @@
  #define JLV2_NUM_WORKERS 1
 #endif
 
+#ifndef JLV2_WORKER_BUFFER_SIZE
+ #define JLV2_WORKER_BUFFER_SIZE 2048
+#endif
+
 namespace jlv2 {
 
 //=============================================================================
 class OptionsFeature :  public LV2Feature
 {
 public:
-    OptionsFeature (SymbolMap& symbolMap)
+    OptionsFeature (SymbolMap& symbolMap, int minBlockLength, int maxBlockLength)
+        : minBlockLengthValue (minBlockLength),
+          maxBlockLengthValue (maxBlockLength)
     {
         uri = LV2_OPTIONS__options;
         feat.URI    = uri.toRawUTF8();
@@ -53,8 +59,8 @@ public:
 
     LV2_Options_Option minBlockLengthOption, maxBlockLengthOption;
     LV2_Options_Option options[3];
-    const int minBlockLengthValue = 128;
-    const int maxBlockLengthValue = 8192;
+    const int minBlockLengthValue;
+    const int maxBlockLengthValue;
     const String& getURI() const { return uri; }
     const LV2_Feature* getFeature() const { return &feat; }
 
@@ -108,10 +114,15 @@ World::World()
     lv2_EventPort   = lilv_new_uri (world, LV2_EVENT__EventPort);
     lv2_CVPort      = lilv_new_uri (world, LV2_CORE__CVPort);
     lv2_enumeration = lilv_new_uri (world, LV2_CORE__enumeration);
+    lv2_inPlaceBroken = lilv_new_uri (world, LV2_CORE__inPlaceBroken);
+    lv2_freeWheeling  = lilv_new_uri (world, LV2_CORE__freeWheeling);
     midi_MidiEvent  = lilv_new_uri (world, LV2_MIDI__MidiEvent);
     work_schedule   = lilv_new_uri (world, LV2_WORKER__schedule);
     work_interface  = lilv_new_uri (world, LV2_WORKER__interface);
     options_options = lilv_new_uri (world, LV2_OPTIONS__options);
+    bufsz_fixedBlockLength    = lilv_new_uri (world, LV2_BUF_SIZE__fixedBlockLength);
+    bufsz_powerOf2BlockLength = lilv_new_uri (world, LV2_BUF_SIZE__powerOf2BlockLength);
+    rsz_minimumSize = lilv_new_uri (world, LV2_RESIZE_PORT__minimumSize);
     ui_CocoaUI      = lilv_new_uri (world, LV2_UI__CocoaUI);
     ui_WindowsUI    = lilv_new_uri (world, LV2_UI__WindowsUI);
     ui_X11UI        = lilv_new_uri (world, LV2_UI__X11UI);
@@ -136,18 +147,13 @@ World::World()
                           ModuleUI::portUnsubscribe);
     suil_host_set_touch_func (suil, ModuleUI::touch);
 
-    currentThread = 0;
-    numThreads    = JLV2_NUM_WORKERS;
-    for (int i = 0; i < numThreads; ++i)
-    {
-        threads.add (new WorkThread ("lv2_worker_" + String(i + 1), 2048));
-        threads.getLast()->setPriority (5);
-    }
+    workerPool.reset (new WorkerPool (JLV2_NUM_WORKERS, 5));
+    workerBufferSize = JLV2_WORKER_BUFFER_SIZE;
 
     addFeature (symbolMap.createMapFeature(), false);
     addFeature (symbolMap.createUnmapFeature(), false);
     addFeature (new LogFeature(), true);
-    addFeature (new OptionsFeature(symbolMap), true);
+    addFeature (new OptionsFeature (symbolMap, minBlockLength, maxBlockLength), true);
     addFeature (new BoundedBlockLengthFeature(), true);
 }
 
@@ -162,10 +168,15 @@ World::~World()
     _node_free (lv2_EventPort);
     _node_free (lv2_CVPort);
     _node_free (lv2_enumeration);
+    _node_free (lv2_inPlaceBroken);
+    _node_free (lv2_freeWheeling);
     _node_free (midi_MidiEvent);
     _node_free (work_schedule);
     _node_free (work_interface);
     _node_free (options_options);
+    _node_free (bufsz_fixedBlockLength);
+    _node_free (bufsz_powerOf2BlockLength);
+    _node_free (rsz_minimumSize);
     _node_free (ui_CocoaUI);
     _node_free (ui_WindowsUI);
     _node_free (ui_GtkUI);
@@ -257,20 +268,6 @@ const LilvPlugins* World::getAllPlugins() const
     return lilv_world_get_all_plugins (world);
 }
 
-WorkThread& World::getWorkThread()
-{
-    while (threads.size() < numThreads) {
-        threads.add (new WorkThread ("LV2 Worker " + String(threads.size()), 2048));
-        threads.getLast()->setPriority (5);
-    }
-
-    const int32 threadIndex = currentThread;
-    if (++currentThread >= numThreads)
-        currentThread = 0;
-
-    return *threads.getUnchecked (threadIndex);
-}
-
 bool World::isFeatureSupported (const String& featureURI) const
 {
    if (features.contains (featureURI))
@@ -280,6 +277,11 @@ bool World::isFeatureSupported (const String& featureURI) const
        featureURI == LV2_STATE__loadDefaultState)
       return true;
 
+   // provided per instance, LV2PluginInstance re-blocks the host's buffers
+   if (featureURI == LV2_BUF_SIZE__fixedBlockLength ||
+       featureURI == LV2_BUF_SIZE__powerOf2BlockLength)
+      return true;
+
    JLV2_LOG ("warning: feature " + featureURI + " not supported.");
    return false;
 }
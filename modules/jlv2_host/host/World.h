@@ -50,10 +50,15 @@ public:
     const LilvNode*   lv2_EventPort;
     const LilvNode*   lv2_CVPort;
     const LilvNode*   lv2_enumeration;
+    const LilvNode*   lv2_inPlaceBroken;
+    const LilvNode*   lv2_freeWheeling;
     const LilvNode*   midi_MidiEvent;
     const LilvNode*   work_schedule;
     const LilvNode*   work_interface;
     const LilvNode*   options_options;
+    const LilvNode*   bufsz_fixedBlockLength;
+    const LilvNode*   bufsz_powerOf2BlockLength;
+    const LilvNode*   rsz_minimumSize;
     const LilvNode*   ui_CocoaUI;
     const LilvNode*   ui_WindowsUI;
     const LilvNode*   ui_X11UI;
@@ -105,12 +110,26 @@ public:
         to a plugin instance */
     inline void getFeatures (Array<const LV2_Feature*>& feats) const { features.getFeatures (feats); }
 
-    /** Get a worker thread */
-    inline WorkThread& getWorkThread();
+    /** Returns the thread pool which runs plugin worker requests */
+    inline WorkerPool& getWorkerPool() { return *workerPool; }
 
-    /** Returns the total number of available worker threads */
-    inline int32 getNumWorkThreads() const { return numThreads; }
+    /** Returns the number of threads running worker requests */
+    inline int32 getNumWorkThreads() const { return workerPool->getNumThreads(); }
+
+    /** Set the smallest request and response buffer given to plugin workers.
+        Plugins asking for larger port buffers get larger worker buffers too.
+        Applies to plugins instantiated afterwards. */
+    inline void setWorkerBufferSize (uint32 bytes) { workerBufferSize = bytes; }
+
+    /** Returns the smallest request and response buffer given to plugin workers */
+    inline uint32 getWorkerBufferSize() const { return workerBufferSize; }
     
+    /** Returns the minimum block length advertised to plugins via buf-size */
+    inline int32 getMinBlockLength() const { return minBlockLength; }
+
+    /** Returns the maximum block length advertised to plugins via buf-size */
+    inline int32 getMaxBlockLength() const { return maxBlockLength; }
+
     /** Returns a plugin's name by URI, or empty if not found */
     String getPluginName (const String& uri) const;
 
@@ -141,9 +160,12 @@ private:
     SymbolMap symbolMap;
     LV2FeatureArray features;
 
-    // a simple rotating thread pool
-    int32 currentThread, numThreads;
-    OwnedArray<WorkThread> threads;
+    // bounded block lengths published through the options feature
+    const int32 minBlockLength = 128;
+    const int32 maxBlockLength = 8192;
+
+    std::unique_ptr<WorkerPool> workerPool;
+    uint32 workerBufferSize;
 };
 
 }
@@ -41,6 +41,7 @@
 #include <lv2/lv2plug.in/ns/ext/log/log.h>
 #include <lv2/lv2plug.in/ns/ext/midi/midi.h>
 #include <lv2/lv2plug.in/ns/ext/options/options.h>
+#include <lv2/lv2plug.in/ns/ext/resize-port/resize-port.h>
 #include <lv2/lv2plug.in/ns/ext/state/state.h>
 #include <lv2/lv2plug.in/ns/ext/urid/urid.h>
 #include <lv2/lv2plug.in/ns/ext/uri-map/uri-map.h>
@@ -53,8 +54,15 @@
  #include <gtk/gtk.h>
 #endif
 
+#if JUCE_MAC
+ #include <dispatch/dispatch.h>
+#elif JUCE_WINDOWS
+ #include <windows.h>
+#else
+ #include <semaphore.h>
+#endif
+
 namespace jlv2 {
-class Module;
 class ModuleUI;
 }
 
@@ -65,7 +73,11 @@ class ModuleUI;
 #include "host/PortEvent.h"
 #include "host/LV2Features.h"
 #include "host/SymbolMap.h"
-#include "host/RingBuffer.h"
+#include "host/PortValueTable.h"
+#include "host/SampleConversion.h"
+#include "host/MessageQueue.h"
+#include "host/MultiProducerQueue.h"
+#include "host/WorkStealingDeque.h"
 #include "host/WorkThread.h"
 #include "host/LogFeature.h"
 #include "host/WorkerFeature.h"
@@ -75,7 +87,9 @@ class ModuleUI;
 #include "host/LogFeature.cpp"
 #include "host/LV2PluginFormat.cpp"
 #include "host/Module.cpp"
+#include "host/ModuleGraph.cpp"
 #include "host/PortBuffer.cpp"
+#include "host/ProcessScheduler.cpp"
 #include "host/RingBuffer.cpp"
 #include "host/WorkerFeature.cpp"
 #include "host/WorkThread.cpp"
@@ -76,11 +76,22 @@
 #endif
 
 
+#ifndef JLV2_INVALID_PORT
+ #define JLV2_INVALID_PORT (uint32)-1
+#endif
+
 namespace jlv2 {
 using namespace juce;
 class World;
 class SymbolMap;
+class Module;
 }
 
+#include "host/RunProfile.h"
+#include "host/Histogram.h"
+#include "host/RingBuffer.h"
+#include "host/ModuleStats.h"
 #include "host/LV2PluginFormat.h"
+#include "host/ProcessScheduler.h"
+#include "host/ModuleGraph.h"
 #endif
@@ -0,0 +1,303 @@
+#include <juce/juce.h>
+#include <jlv2/jlv2.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace juce;
+
+namespace {
+
+struct BenchOptions
+{
+    String uri;
+    Array<double> sampleRates { 48000.0 };
+    Array<int> blockSizes { 64, 128, 256, 512, 1024 };
+    double seconds = 10.0;      ///< audio time to run per configuration
+    int warmup = 64;            ///< cycles to run before measuring
+    int midiEvents = -1;        ///< per block, -1 picks 2 for MIDI plugins
+    bool reconnectAll = false;  ///< reconnect every port each block, for comparison
+    bool doublePrecision = false;   ///< process AudioBuffer<double>, converting around the plugin
+    File output;
+
+    bool parse (const StringArray& args, String& error)
+    {
+        for (int i = 0; i < args.size(); ++i)
+        {
+            const auto& arg = args[i];
+            const bool hasValue = i + 1 < args.size();
+
+            if ((arg == "-r" || arg == "--rates") && hasValue)
+            {
+                sampleRates.clearQuick();
+                for (const auto& r : StringArray::fromTokens (args[++i], ",", {}))
+                    sampleRates.add (r.getDoubleValue());
+            }
+            else if ((arg == "-b" || arg == "--blocks") && hasValue)
+            {
+                blockSizes.clearQuick();
+                for (const auto& b : StringArray::fromTokens (args[++i], ",", {}))
+                    blockSizes.add (b.getIntValue());
+            }
+            else if ((arg == "-s" || arg == "--seconds") && hasValue)
+                seconds = args[++i].getDoubleValue();
+            else if ((arg == "-w" || arg == "--warmup") && hasValue)
+                warmup = args[++i].getIntValue();
+            else if ((arg == "-m" || arg == "--midi") && hasValue)
+                midiEvents = args[++i].getIntValue();
+            else if (arg == "-c" || arg == "--reconnect-all")
+                reconnectAll = true;
+            else if (arg == "-d" || arg == "--double")
+                doublePrecision = true;
+            else if ((arg == "-o" || arg == "--output") && hasValue)
+                output = File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+            else if (arg.startsWith ("-"))
+                return fail (error, "unknown option: " + arg);
+            else if (uri.isEmpty())
+                uri = arg;
+            else
+                return fail (error, "only one plugin URI can be benchmarked at a time");
+        }
+
+        if (uri.isEmpty())
+            return fail (error, "no plugin URI given");
+        for (const auto rate : sampleRates)
+            if (rate <= 0.0)
+                return fail (error, "invalid sample rate");
+        for (const auto block : blockSizes)
+            if (block <= 0)
+                return fail (error, "invalid block size");
+        if (seconds <= 0.0)
+            return fail (error, "invalid duration");
+        return true;
+    }
+
+    static bool fail (String& error, const String& message)
+    {
+        error = message;
+        return false;
+    }
+};
+
+void printUsage()
+{
+    std::cout << "usage: lv2bench [options] URI" << std::endl
+              << std::endl
+              << "Measures the DSP cost of an LV2 plugin hosted by jlv2 and prints JSON." << std::endl
+              << std::endl
+              << "  -r, --rates LIST        comma separated sample rates (default 48000)" << std::endl
+              << "  -b, --blocks LIST       comma separated block sizes (default 64,128,256,512,1024)" << std::endl
+              << "  -s, --seconds N         audio time to process per configuration (default 10)" << std::endl
+              << "  -w, --warmup N          cycles to run before measuring (default 64)" << std::endl
+              << "  -m, --midi N            MIDI events per block (default 2 for MIDI plugins)" << std::endl
+              << "  -c, --reconnect-all     reconnect every port each block instead of only moved ones" << std::endl
+              << "  -d, --double            process double precision buffers" << std::endl
+              << "  -o, --output FILE       write the JSON to a file instead of stdout" << std::endl;
+}
+
+/** Returns the value at a fraction through sorted samples */
+double percentile (const std::vector<int64>& sorted, double fraction)
+{
+    const auto index = jmin (sorted.size() - 1, (size_t) (fraction * (double) sorted.size()));
+    return (double) sorted[index];
+}
+
+var runConfiguration (AudioPluginFormatManager& plugins, const BenchOptions& opts,
+                      double sampleRate, int blockSize, String& error)
+{
+    PluginDescription desc;
+    desc.pluginFormatName = "LV2";
+    desc.fileOrIdentifier = opts.uri;
+
+    auto plugin = plugins.createPluginInstance (desc, sampleRate, blockSize, error);
+    if (plugin == nullptr)
+        return var();
+
+    jlv2::RunProfile profile;
+    profile.reconnectAll = opts.reconnectAll;
+    jlv2::LV2PluginFormat::setRunProfile (*plugin, &profile);
+    if (opts.doublePrecision)
+        plugin->setProcessingPrecision (AudioProcessor::doublePrecision);
+    plugin->prepareToPlay (sampleRate, blockSize);
+
+    const int numChannels = jmax (1, plugin->getTotalNumInputChannels(),
+                                     plugin->getTotalNumOutputChannels());
+    AudioSampleBuffer noise (numChannels, blockSize), audio (numChannels, blockSize);
+    AudioBuffer<double> noiseDouble, audioDouble (numChannels, blockSize);
+    Random random (0x6a6c7632);
+    for (int c = 0; c < numChannels; ++c)
+        for (int i = 0; i < blockSize; ++i)
+            noise.setSample (c, i, random.nextFloat() * 0.5f - 0.25f);
+    noiseDouble.makeCopyOf (noise);
+
+    const int midiEvents = opts.midiEvents >= 0 ? opts.midiEvents
+                                                : (plugin->acceptsMidi() ? 2 : 0);
+    MidiBuffer midi;
+    midi.ensureSize (4096);
+    int note = 48;
+
+    const int cycles = jmax (1, (int) std::ceil (opts.seconds * sampleRate / blockSize));
+    std::vector<int64> ticks ((size_t) cycles);
+    int64 processTicks = 0;
+
+    for (int cycle = -opts.warmup; cycle < cycles; ++cycle)
+    {
+        if (opts.doublePrecision)
+            for (int c = 0; c < numChannels; ++c)
+                audioDouble.copyFrom (c, 0, noiseDouble, c, 0, blockSize);
+        else
+            for (int c = 0; c < numChannels; ++c)
+                audio.copyFrom (c, 0, noise, c, 0, blockSize);
+
+        // alternating note on and off spread over the block
+        midi.clear();
+        for (int e = 0; e < midiEvents; ++e)
+        {
+            const int frame = (e * blockSize) / jmax (1, midiEvents);
+            if ((e & 1) == 0)
+                midi.addEvent (MidiMessage::noteOn (1, note, (uint8) 100), frame);
+            else
+                midi.addEvent (MidiMessage::noteOff (1, note), frame);
+            if ((e & 1) == 1)
+                note = 48 + ((note - 47) % 24);
+        }
+
+        if (cycle == 0)
+            profile.reset();
+
+        const int64 start = Time::getHighResolutionTicks();
+        if (opts.doublePrecision)
+            plugin->processBlock (audioDouble, midi);
+        else
+            plugin->processBlock (audio, midi);
+        const int64 elapsed = Time::getHighResolutionTicks() - start;
+
+        if (cycle >= 0)
+        {
+            ticks[(size_t) cycle] = elapsed;
+            processTicks += elapsed;
+        }
+    }
+
+    jlv2::LV2PluginFormat::setRunProfile (*plugin, nullptr);
+    plugin->releaseResources();
+
+    const double nsPerTick = 1.0e9 / (double) Time::getHighResolutionTicksPerSecond();
+    const double deadline  = 1.0e9 * blockSize / sampleRate;
+    int overruns = 0;
+    for (const auto t : ticks)
+        if ((double) t * nsPerTick > deadline)
+            ++overruns;
+
+    std::sort (ticks.begin(), ticks.end());
+
+    auto perBlock = [&] (int64 total) { return (double) total * nsPerTick / cycles; };
+
+    DynamicObject::Ptr block (new DynamicObject());
+    block->setProperty ("meanNs", perBlock (processTicks));
+    block->setProperty ("p50Ns",  percentile (ticks, 0.5)   * nsPerTick);
+    block->setProperty ("p99Ns",  percentile (ticks, 0.99)  * nsPerTick);
+    block->setProperty ("p999Ns", percentile (ticks, 0.999) * nsPerTick);
+    block->setProperty ("maxNs",  (double) ticks.back() * nsPerTick);
+
+    // mean time per block for each phase of Module::run, wrapper is the
+    // AudioPluginInstance around it (MIDI conversion, re-blocking)
+    DynamicObject::Ptr breakdown (new DynamicObject());
+    breakdown->setProperty ("eventsNs",    perBlock (profile.events));
+    breakdown->setProperty ("connectNs",   perBlock (profile.connect));
+    breakdown->setProperty ("workerNs",    perBlock (profile.worker));
+    breakdown->setProperty ("pluginNs",    perBlock (profile.plugin));
+    breakdown->setProperty ("otherHostNs", perBlock (profile.total - profile.events - profile.connect
+                                                      - profile.worker - profile.plugin));
+    breakdown->setProperty ("wrapperNs",   perBlock (processTicks - profile.total));
+    breakdown->setProperty ("runs",        (int64) profile.runs);
+
+    DynamicObject::Ptr result (new DynamicObject());
+    result->setProperty ("sampleRate",     sampleRate);
+    result->setProperty ("blockSize",      blockSize);
+    result->setProperty ("cycles",         cycles);
+    result->setProperty ("midiEvents",     midiEvents);
+    result->setProperty ("reconnectAll",   opts.reconnectAll);
+    result->setProperty ("double",         opts.doublePrecision);
+    result->setProperty ("latencySamples", plugin->getLatencySamples());
+    result->setProperty ("nsPerSample",    (double) processTicks * nsPerTick / ((double) cycles * blockSize));
+    result->setProperty ("deadlineNs",     deadline);
+    result->setProperty ("overruns",       overruns);
+    result->setProperty ("block",          var (block.get()));
+    result->setProperty ("breakdown",      var (breakdown.get()));
+    return var (result.get());
+}
+
+int bench (const BenchOptions& opts)
+{
+    AudioPluginFormatManager plugins;
+    plugins.addFormat (new jlv2::LV2PluginFormat());
+
+    Array<var> results;
+
+    for (const auto rate : opts.sampleRates)
+    {
+        for (const auto block : opts.blockSizes)
+        {
+            String error;
+            const var result = runConfiguration (plugins, opts, rate, block, error);
+            if (result.isVoid())
+            {
+                std::cerr << "lv2bench: " << opts.uri << ": " << error << std::endl;
+                return 1;
+            }
+
+            results.add (result);
+        }
+    }
+
+    DynamicObject::Ptr report (new DynamicObject());
+    report->setProperty ("plugin",  opts.uri);
+    report->setProperty ("juce",    SystemStats::getJUCEVersion());
+    report->setProperty ("cpu",     SystemStats::getCpuVendor());
+    report->setProperty ("cpus",    SystemStats::getNumCpus());
+    report->setProperty ("os",      SystemStats::getOperatingSystemName());
+    report->setProperty ("results", results);
+
+    const String json = JSON::toString (var (report.get()));
+    if (opts.output != File())
+    {
+        if (! opts.output.replaceWithText (json))
+        {
+            std::cerr << "lv2bench: can't write " << opts.output.getFullPathName() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << json << std::endl;
+    }
+
+    return 0;
+}
+
+}
+
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (CharPointer_UTF8 (argv[i]));
+
+    if (args.isEmpty() || args.contains ("-h") || args.contains ("--help"))
+    {
+        printUsage();
+        return args.isEmpty() ? 1 : 0;
+    }
+
+    BenchOptions opts;
+    String error;
+    if (! opts.parse (args, error))
+    {
+        std::cerr << "lv2bench: " << error << std::endl;
+        return 1;
+    }
+
+    ScopedJuceInitialiser_GUI juceInit;
+    return bench (opts);
+}
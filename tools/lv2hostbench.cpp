@@ -0,0 +1,862 @@
+#include <juce/juce.h>
+#include <jlv2/jlv2.h>
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+#include <jlv2_host/host/LV2Features.h>
+#include <jlv2_host/host/SymbolMap.h>
+#include <jlv2_host/host/SampleConversion.h>
+#include <jlv2_host/host/MultiProducerQueue.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace juce;
+
+namespace {
+
+/** Returns the fastest of a few runs of fn, in nanoseconds per item */
+template <typename Fn>
+double nanosPerItem (int64 items, Fn&& fn)
+{
+    double best = 0.0;
+    for (int run = 0; run < 5; ++run)
+    {
+        const int64 start = Time::getHighResolutionTicks();
+        fn();
+        const double seconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best * 1.0e9 / (double) items;
+}
+
+void printTiming (const String& name, double oldNanos, double newNanos)
+{
+    std::cout << name.paddedRight (' ', 24) << "old " << String (oldNanos, 2).paddedLeft (' ', 8)
+              << " ns   new " << String (newNanos, 2).paddedLeft (' ', 8) << " ns   ("
+              << String (newNanos > 0.0 ? oldNanos / newNanos : 0.0, 2) << "x)" << std::endl;
+}
+
+/** Prints a failed check and returns false */
+bool fail (const String& message)
+{
+    std::cerr << "lv2hostbench: FAILED: " << message << std::endl;
+    return false;
+}
+
+/** Prints why a mode couldn't run and returns true, for modes needing plugins */
+bool skip (const String& mode, const String& reason)
+{
+    std::cout << mode << ": skipped, " << reason << std::endl;
+    return true;
+}
+
+//=============================================================================
+/** The LV2 example amplifier, for modes that need a real plugin. Its gain in
+    dB (-90 to 24) is port 0, the audio input port 1 and the output port 2 */
+const char* const ampURI = "http://lv2plug.in/plugins/eg-amp";
+
+/** Returns the gain eg-amp applies for a value in dB */
+float ampGain (float db)
+{
+    return db > -90.f ? std::pow (10.f, db * 0.05f) : 0.f;
+}
+
+//=============================================================================
+/** SampleConversion against AudioBuffer::makeCopyOf, the JUCE fallback */
+bool benchConvert()
+{
+    const int numChannels = 2, numSamples = 512, blocks = 20000;
+    AudioBuffer<double> doubles (numChannels, numSamples);
+    AudioBuffer<float>  floats (numChannels, numSamples), expected (numChannels, numSamples);
+
+    Random random (0x6a6c7632);
+    for (int c = 0; c < numChannels; ++c)
+        for (int i = 0; i < numSamples; ++i)
+            doubles.setSample (c, i, random.nextDouble() * 2.0 - 1.0);
+
+    expected.makeCopyOf (doubles, true);
+    for (int c = 0; c < numChannels; ++c)
+        jlv2::SampleConversion::toFloat (floats.getWritePointer (c), doubles.getReadPointer (c), numSamples);
+    for (int c = 0; c < numChannels; ++c)
+        if (memcmp (floats.getReadPointer (c), expected.getReadPointer (c), sizeof (float) * numSamples) != 0)
+            return fail ("toFloat doesn't match makeCopyOf");
+
+    const int64 samples = (int64) numChannels * numSamples * blocks;
+
+    const double juceToFloat = nanosPerItem (samples, [&] {
+        for (int b = 0; b < blocks; ++b)
+            floats.makeCopyOf (doubles, true);
+    });
+    const double jlv2ToFloat = nanosPerItem (samples, [&] {
+        for (int b = 0; b < blocks; ++b)
+            for (int c = 0; c < numChannels; ++c)
+                jlv2::SampleConversion::toFloat (floats.getWritePointer (c), doubles.getReadPointer (c), numSamples);
+    });
+    const double juceToDouble = nanosPerItem (samples, [&] {
+        for (int b = 0; b < blocks; ++b)
+            doubles.makeCopyOf (floats, true);
+    });
+    const double jlv2ToDouble = nanosPerItem (samples, [&] {
+        for (int b = 0; b < blocks; ++b)
+            for (int c = 0; c < numChannels; ++c)
+                jlv2::SampleConversion::toDouble (doubles.getWritePointer (c), floats.getReadPointer (c), numSamples);
+    });
+
+    std::cout << "convert: per sample, old is AudioBuffer::makeCopyOf, new is SampleConversion"
+              << (JLV2_USE_SSE2 ? " (SSE2)" : " (scalar)") << std::endl;
+    printTiming ("double to float", juceToFloat, jlv2ToFloat);
+    printTiming ("float to double", juceToDouble, jlv2ToDouble);
+    return true;
+}
+
+//=============================================================================
+/** The AbstractFifo based RingBuffer the host used before the lock free one,
+    kept to compare against. The original shared its fifo vectors between
+    the reader and the writer, which races, so these are locals here. */
+class LegacyRingBuffer
+{
+public:
+    LegacyRingBuffer (int32 capacity)
+        : fifo (1)
+    {
+        capacity = nextPowerOfTwo (capacity);
+        block.allocate ((size_t) capacity, true);
+        fifo.setTotalSize (capacity);
+    }
+
+    bool canRead  (uint32 bytes) const { return bytes <= (uint32) fifo.getNumReady() && bytes != 0; }
+    bool canWrite (uint32 bytes) const { return bytes <= (uint32) fifo.getFreeSpace() && bytes != 0; }
+
+    uint32 read (void* dest, uint32 size, bool advance = true)
+    {
+        Vec vec1, vec2;
+        fifo.prepareToRead ((int) size, vec1.index, vec1.size, vec2.index, vec2.size);
+        if (vec1.size > 0)
+            memcpy (dest, block + vec1.index, (size_t) vec1.size);
+        if (vec2.size > 0)
+            memcpy ((uint8*) dest + vec1.size, block + vec2.index, (size_t) vec2.size);
+        if (advance)
+            fifo.finishedRead (vec1.size + vec2.size);
+        return (uint32) (vec1.size + vec2.size);
+    }
+
+    uint32 write (const void* src, uint32 bytes)
+    {
+        Vec vec1, vec2;
+        fifo.prepareToWrite ((int) bytes, vec1.index, vec1.size, vec2.index, vec2.size);
+        if (vec1.size > 0)
+            memcpy (block + vec1.index, src, (size_t) vec1.size);
+        if (vec2.size > 0)
+            memcpy (block + vec2.index, (const uint8*) src + vec1.size, (size_t) vec2.size);
+        fifo.finishedWrite (vec1.size + vec2.size);
+        return (uint32) (vec1.size + vec2.size);
+    }
+
+private:
+    struct Vec { int size, index; };
+    AbstractFifo fifo;
+    HeapBlock<uint8> block;
+};
+
+/** Ring messages are a sequence number followed by a payload whose size and
+    bytes are derived from it, so the reader can check every one */
+enum { ringHeaderSize = sizeof (uint32), maxRingPayload = 64 };
+
+uint32 ringPayloadSize (uint32 seq)                 { return 1 + seq % maxRingPayload; }
+uint8 ringPayloadByte (uint32 seq, uint32 index)    { return (uint8) (seq * 31u + index); }
+
+uint32 makeRingMessage (uint8* message, uint32 seq)
+{
+    const uint32 size = ringPayloadSize (seq);
+    memcpy (message, &seq, ringHeaderSize);
+    for (uint32 i = 0; i < size; ++i)
+        message[ringHeaderSize + i] = ringPayloadByte (seq, i);
+    return ringHeaderSize + size;
+}
+
+bool checkRingMessage (const uint8* message, uint32 expected)
+{
+    uint32 seq = 0;
+    memcpy (&seq, message, ringHeaderSize);
+    if (seq != expected)
+        return false;
+    for (uint32 i = 0; i < ringPayloadSize (seq); ++i)
+        if (message[ringHeaderSize + i] != ringPayloadByte (seq, i))
+            return false;
+    return true;
+}
+
+/** Streams count messages from a producer thread to this one with write and
+    read, which both ring buffers have. Returns false if one arrives wrong */
+template <typename Ring>
+bool transferMessages (Ring& ring, uint32 count)
+{
+    std::thread producer ([&ring, count] {
+        uint8 message [ringHeaderSize + maxRingPayload];
+        for (uint32 seq = 0; seq < count; ++seq)
+        {
+            const uint32 size = makeRingMessage (message, seq);
+            while (! ring.canWrite (size))
+                std::this_thread::yield();
+            ring.write (message, size);
+        }
+    });
+
+    bool ok = true;
+    uint8 message [ringHeaderSize + maxRingPayload];
+    for (uint32 seq = 0; seq < count; ++seq)
+    {
+        // the producer writes each message whole, so the payload is there once the header is
+        while (! ring.canRead (ringHeaderSize))
+            std::this_thread::yield();
+        ring.read (static_cast<void*> (message), ringHeaderSize + ringPayloadSize (seq));
+        ok = ok && checkRingMessage (message, seq);
+    }
+
+    producer.join();
+    return ok;
+}
+
+/** Streams count messages written in place with reserve/commit and read in
+    place with peek/consume, which only the new ring buffer has */
+bool transferSpans (jlv2::RingBuffer& ring, uint32 count)
+{
+    std::thread producer ([&ring, count] {
+        uint8 message [ringHeaderSize + maxRingPayload];
+        for (uint32 seq = 0; seq < count; ++seq)
+        {
+            const uint32 size = makeRingMessage (message, seq);
+            auto span = ring.reserve (size);
+            for (; span.isEmpty(); span = ring.reserve (size))
+                std::this_thread::yield();
+            span.copyFrom (message, 0, size);
+            ring.commit (size);
+        }
+    });
+
+    bool ok = true;
+    uint8 message [ringHeaderSize + maxRingPayload];
+    for (uint32 seq = 0; seq < count; ++seq)
+    {
+        const uint32 size = ringHeaderSize + ringPayloadSize (seq);
+        auto span = ring.peek (size);
+        for (; span.isEmpty(); span = ring.peek (size))
+            std::this_thread::yield();
+        span.copyTo (message, 0, size);
+        ring.consume (size);
+        ok = ok && checkRingMessage (message, seq);
+    }
+
+    producer.join();
+    return ok;
+}
+
+/** The lock free RingBuffer against the AbstractFifo one it replaced */
+bool benchRing()
+{
+    const int32 capacity = 4096;
+    const uint32 stressCount = 1u << 20, benchCount = 1u << 18, roundTrips = 1u << 21;
+
+    jlv2::RingBuffer ring (capacity);
+    LegacyRingBuffer legacy (capacity);
+
+    // advance must refuse to skip more than is there
+    if (ring.advance (1, false))
+        return fail ("ring advanced the read side of an empty buffer");
+    uint8 filler [capacity] = {};
+    if (ring.write (filler, capacity) != (uint32) capacity || ring.advance (1, true))
+        return fail ("ring advanced the write side of a full buffer");
+    if (! ring.advance (capacity, false) || ring.getReadSpace() != 0)
+        return fail ("ring couldn't skip a full buffer");
+
+    // the stress runs cover every wrap offset many times over
+    if (! transferMessages (ring, stressCount))
+        return fail ("ring write/read delivered a wrong message");
+    if (! transferSpans (ring, stressCount))
+        return fail ("ring reserve/commit delivered a wrong message");
+    if (! transferMessages (legacy, benchCount))
+        return fail ("legacy ring delivered a wrong message");
+
+    uint8 message [ringHeaderSize + maxRingPayload];
+    const uint32 messageSize = makeRingMessage (message, 31);
+
+    const double legacyRoundTrip = nanosPerItem (roundTrips, [&] {
+        for (uint32 i = 0; i < roundTrips; ++i)
+        {
+            legacy.write (message, messageSize);
+            legacy.read (static_cast<void*> (message), messageSize);
+        }
+    });
+    const double ringRoundTrip = nanosPerItem (roundTrips, [&] {
+        for (uint32 i = 0; i < roundTrips; ++i)
+        {
+            ring.write (message, messageSize);
+            ring.read (static_cast<void*> (message), messageSize);
+        }
+    });
+    const double legacyStream = nanosPerItem (benchCount, [&] { transferMessages (legacy, benchCount); });
+    const double ringStream   = nanosPerItem (benchCount, [&] { transferMessages (ring, benchCount); });
+    const double spanStream   = nanosPerItem (benchCount, [&] { transferSpans (ring, benchCount); });
+
+    std::cout << "ring: per message, old is the AbstractFifo RingBuffer, " << (int) stressCount
+              << " messages checked each way" << std::endl;
+    printTiming ("write+read, 1 thread", legacyRoundTrip, ringRoundTrip);
+    printTiming ("write/read, 2 threads", legacyStream, ringStream);
+    printTiming ("reserve/peek, 2 threads", legacyStream, spanStream);
+    return true;
+}
+
+//=============================================================================
+/** Who sent a MultiProducerQueue message, and its place in that sender's stream */
+struct ProducerHeader
+{
+    uint32 producer;
+    uint32 seq;
+};
+
+uint32 producerPayloadSize (uint32 producer, uint32 seq)            { return (seq * 7u + producer) % 100u; }
+uint8 producerPayloadByte (uint32 producer, uint32 seq, uint32 i)  { return (uint8) (seq * 13u + producer + i); }
+
+/** Several threads writing to one MultiProducerQueue while this thread reads.
+    Every producer's messages must arrive in the order sent, intact. */
+bool benchMultiProducer()
+{
+    const uint32 numProducers = 4, perProducer = 250000;
+    jlv2::MultiProducerQueue<ProducerHeader> queue (4096);
+    std::atomic<int64> fullWrites { 0 };
+    std::atomic<uint32> running { numProducers };
+
+    std::vector<std::thread> producers;
+    const int64 start = Time::getHighResolutionTicks();
+
+    for (uint32 p = 0; p < numProducers; ++p)
+    {
+        producers.emplace_back ([&queue, &fullWrites, &running, p] {
+            uint8 payload [100];
+            for (uint32 seq = 0; seq < perProducer;)
+            {
+                const uint32 size = producerPayloadSize (p, seq);
+                for (uint32 i = 0; i < size; ++i)
+                    payload[i] = producerPayloadByte (p, seq, i);
+
+                if (queue.write ({ p, seq }, payload, size))
+                {
+                    ++seq;
+                }
+                else
+                {
+                    ++fullWrites;
+                    std::this_thread::yield();
+                }
+            }
+
+            --running;
+        });
+    }
+
+    std::vector<uint32> next (numProducers, 0);
+    const uint64 total = (uint64) numProducers * perProducer;
+    uint64 received = 0;
+    String error;
+
+    // keep draining after an error so the producers can finish
+    while (running.load() > 0 || ! queue.isEmpty())
+    {
+        const uint32 count = queue.readAll ([&] (const ProducerHeader& header, const void* data, uint32 size) {
+            if (! error.isEmpty())
+                return;
+            if (header.producer >= numProducers)
+                error = "message from unknown producer " + String (header.producer);
+            else if (header.seq != next[header.producer])
+                error = "expected " + String (next[header.producer]) + " from producer " + String (header.producer)
+                      + " but " + String (header.seq) + " arrived";
+            else if (size != producerPayloadSize (header.producer, header.seq))
+                error = "wrong payload size for producer " + String (header.producer);
+
+            const auto* const bytes = static_cast<const uint8*> (data);
+            for (uint32 i = 0; i < size && error.isEmpty(); ++i)
+                if (bytes[i] != producerPayloadByte (header.producer, header.seq, i))
+                    error = "corrupt payload from producer " + String (header.producer);
+
+            ++next[header.producer % numProducers];
+        });
+
+        received += count;
+        if (count == 0)
+            std::this_thread::yield();
+    }
+
+    for (auto& producer : producers)
+        producer.join();
+
+    if (error.isNotEmpty())
+        return fail ("mpsc: " + error);
+    if (received != total)
+        return fail ("mpsc: " + String ((int64) received) + " of " + String ((int64) total) + " messages arrived");
+
+    const double seconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+    std::cout << "mpsc: " << (int) numProducers << " producers, " << (int64) total << " messages in order, "
+              << String (seconds * 1.0e9 / (double) total, 2) << " ns per message, "
+              << fullWrites.load() << " writes found the queue full" << std::endl;
+    return true;
+}
+
+//=============================================================================
+/** The unordered_map based SymbolMap the host used before the lock free one,
+    reduced to map and unmap, kept to compare against */
+class LegacySymbolMap
+{
+public:
+    LV2_URID map (const char* key)
+    {
+        if (mapped.find (key) == mapped.end())
+        {
+            const LV2_URID urid (1 + (LV2_URID) mapped.size());
+            mapped [key] = urid;
+            unmapped [urid] = std::string (key);
+            return urid;
+        }
+
+        return mapped [key];
+    }
+
+    const char* unmap (LV2_URID urid)
+    {
+        if (unmapped.find (urid) != unmapped.end())
+            return unmapped [urid].c_str();
+        return "";
+    }
+
+private:
+    std::unordered_map<std::string, LV2_URID> mapped;
+    std::unordered_map<LV2_URID, std::string> unmapped;
+};
+
+StringArray makeURIs (int count)
+{
+    StringArray uris;
+    for (int i = 0; i < count; ++i)
+        uris.add ("http://example.org/plugins/some-plugin#uri_" + String (i));
+    return uris;
+}
+
+/** Threads racing to map overlapping URIs must agree on one dense, unique
+    URID per URI, and unmap must return each URI while others insert */
+bool stressSymbols()
+{
+    const int numThreads = 8, numURIs = 20000;
+    const StringArray uris (makeURIs (numURIs));
+    jlv2::SymbolMap symbols;
+    std::atomic<int> mismatches { 0 };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back ([&, t] {
+            for (int i = 0; i < numURIs; ++i)
+            {
+                // each thread walks the URIs in a different order
+                const char* uri = uris.getReference ((i * 7 + t * 131) % numURIs).toRawUTF8();
+                const LV2_URID urid = symbols.map (uri);
+                if (urid == 0 || strcmp (symbols.unmap (urid), uri) != 0)
+                    ++mismatches;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    if (mismatches.load() > 0)
+        return fail ("symbols: " + String (mismatches.load()) + " URIs didn't round trip while mapping");
+    if (symbols.size() != (uint32) numURIs)
+        return fail ("symbols: mapped " + String (symbols.size()) + " URIDs for " + String (numURIs) + " URIs");
+
+    std::vector<bool> seen ((size_t) numURIs + 1, false);
+    for (const auto& uri : uris)
+    {
+        const LV2_URID urid = symbols.map (uri.toRawUTF8());
+        if (urid < 1 || urid > (LV2_URID) numURIs || seen[urid])
+            return fail ("symbols: URIDs aren't dense and unique");
+        seen[urid] = true;
+    }
+
+    std::cout << "symbols: " << numThreads << " threads mapped " << numURIs
+              << " URIs to dense unique URIDs" << std::endl;
+    return true;
+}
+
+/** The lock free SymbolMap against the unordered_map one it replaced */
+bool benchSymbols()
+{
+    if (! stressSymbols())
+        return false;
+
+    const int numURIs = 2000, rounds = 200;
+    const StringArray uris (makeURIs (numURIs));
+    const int64 lookups = (int64) numURIs * rounds;
+    std::atomic<uint32> sink { 0 };
+
+    // inserts only happen once per map, so time fresh maps
+    const double legacyInsert = nanosPerItem (numURIs, [&] {
+        LegacySymbolMap legacy;
+        for (const auto& uri : uris)
+            legacy.map (uri.toRawUTF8());
+    });
+    const double newInsert = nanosPerItem (numURIs, [&] {
+        jlv2::SymbolMap symbols;
+        for (const auto& uri : uris)
+            symbols.map (uri.toRawUTF8());
+    });
+
+    LegacySymbolMap legacy;
+    jlv2::SymbolMap symbols;
+    for (const auto& uri : uris)
+    {
+        legacy.map (uri.toRawUTF8());
+        symbols.map (uri.toRawUTF8());
+    }
+
+    const double legacyMap = nanosPerItem (lookups, [&] {
+        uint32 sum = 0;
+        for (int r = 0; r < rounds; ++r)
+            for (const auto& uri : uris)
+                sum += legacy.map (uri.toRawUTF8());
+        sink += sum;
+    });
+    const double newMap = nanosPerItem (lookups, [&] {
+        uint32 sum = 0;
+        for (int r = 0; r < rounds; ++r)
+            for (const auto& uri : uris)
+                sum += symbols.map (uri.toRawUTF8());
+        sink += sum;
+    });
+    const double legacyUnmap = nanosPerItem (lookups, [&] {
+        uint32 sum = 0;
+        for (int r = 0; r < rounds; ++r)
+            for (LV2_URID urid = 1; urid <= (LV2_URID) numURIs; ++urid)
+                sum += (uint8) legacy.unmap (urid)[0];
+        sink += sum;
+    });
+    const double newUnmap = nanosPerItem (lookups, [&] {
+        uint32 sum = 0;
+        for (int r = 0; r < rounds; ++r)
+            for (LV2_URID urid = 1; urid <= (LV2_URID) numURIs; ++urid)
+                sum += (uint8) symbols.unmap (urid)[0];
+        sink += sum;
+    });
+
+    std::cout << "symbols: per URI, old is the unordered_map SymbolMap, " << numURIs << " URIs" << std::endl;
+    printTiming ("map new URI", legacyInsert, newInsert);
+    printTiming ("map mapped URI", legacyMap, newMap);
+    printTiming ("unmap", legacyUnmap, newUnmap);
+    return true;
+}
+
+//=============================================================================
+/** A MIDI controller mapped to a parameter must change it on the sample the
+    controller arrived on */
+bool benchAutomation()
+{
+    const double sampleRate = 48000.0;
+    const int blockSize = 512, frame = 200;
+
+    AudioPluginFormatManager plugins;
+    plugins.addFormat (new jlv2::LV2PluginFormat());
+
+    PluginDescription desc;
+    desc.pluginFormatName = "LV2";
+    desc.fileOrIdentifier = ampURI;
+
+    String error;
+    auto plugin = plugins.createPluginInstance (desc, sampleRate, blockSize, error);
+    if (plugin == nullptr)
+        return skip ("automation", String (ampURI) + " isn't available: " + error);
+
+    // the gain is the amp's only parameter
+    auto* const gain = plugin->getParameters()[0];
+    if (gain == nullptr || ! jlv2::LV2PluginFormat::setControllerParameter (*plugin, 7, 0))
+        return fail ("automation: can't map a controller to the amp's gain");
+
+    gain->setValue (0.f);
+    plugin->prepareToPlay (sampleRate, blockSize);
+
+    AudioSampleBuffer audio (1, blockSize);
+    MidiBuffer midi;
+    audio.clear();
+    plugin->processBlock (audio, midi);
+
+    // full scale on controller 7 is 24 dB, from -90 (silence) before it
+    for (int i = 0; i < blockSize; ++i)
+        audio.setSample (0, i, 1.f);
+    midi.addEvent (MidiMessage::controllerEvent (1, 7, 127), frame);
+    plugin->processBlock (audio, midi);
+    plugin->releaseResources();
+
+    for (int i = 0; i < blockSize; ++i)
+    {
+        const float expected = ampGain (i < frame ? -90.f : 24.f);
+        const float actual = audio.getSample (0, i);
+        if (std::abs (actual - expected) > expected * 1.0e-4f)
+            return fail ("automation: sample " + String (i) + " is " + String (actual)
+                         + " but the value written for frame " + String (frame)
+                         + " should make it " + String (expected));
+    }
+
+    std::cout << "automation: a controller at frame " << frame << " of " << blockSize
+              << " changed the amp's gain on that frame" << std::endl;
+    return true;
+}
+
+//=============================================================================
+/** Layers of tasks where each task waits on two of the layer before it,
+    recording how often every task runs and whether it ran too early */
+class LayeredTaskGraph : public jlv2::ProcessTaskGraph
+{
+public:
+    LayeredTaskGraph (int numLayers, int layerWidth)
+        : width (layerWidth), numTasks (numLayers * layerWidth),
+          runs (new std::atomic<int> [(size_t) numTasks])
+    {
+        for (int t = 0; t < numTasks; ++t)
+        {
+            runs[t].store (0, std::memory_order_relaxed);
+            dependencies.add (Array<int>());
+            dependents.add (Array<int>());
+        }
+
+        for (int t = width; t < numTasks; ++t)
+        {
+            const int above = t - width, layerStart = above - above % width;
+            for (const int d : { above, layerStart + (above - layerStart + 1) % width })
+            {
+                if (dependencies.getReference (t).addIfNotAlreadyThere (d))
+                    dependents.getReference (d).add (t);
+            }
+        }
+    }
+
+    int getNumTasks() const override                    { return numTasks; }
+    int getNumDependencies (int task) const override    { return dependencies.getReference (task).size(); }
+    const Array<int>& getDependents (int task) const override { return dependents.getReference (task); }
+
+    void runTask (int task) override
+    {
+        // every dependency must have finished its run for this cycle
+        for (const int d : dependencies.getReference (task))
+            if (runs[d].load (std::memory_order_acquire) != cycle + 1)
+                ++earlyRuns;
+
+        volatile float work = 0.f;
+        for (int i = 0; i < 200; ++i)
+            work = work + (float) i;
+
+        runs[task].fetch_add (1, std::memory_order_release);
+    }
+
+    /** Returns the first task that didn't run exactly once per cycle, or -1 */
+    int findMiscountedTask() const
+    {
+        for (int t = 0; t < numTasks; ++t)
+            if (runs[t].load() != cycle + 1)
+                return t;
+        return -1;
+    }
+
+    int cycle = 0;
+    std::atomic<int> earlyRuns { 0 };
+
+private:
+    const int width, numTasks;
+    std::unique_ptr<std::atomic<int>[]> runs;
+    Array<Array<int>> dependencies, dependents;
+};
+
+/** A wide graph on the work stealing scheduler must run every task exactly
+    once per cycle after its dependencies, including after the workers have
+    gone to sleep between cycles */
+bool benchScheduler()
+{
+    const int numLayers = 8, width = 32, cycles = 2000;
+    const int numThreads = jmax (4, SystemStats::getNumCpus());
+
+    jlv2::ProcessScheduler scheduler (numThreads, numLayers * width);
+    LayeredTaskGraph graph (numLayers, width);
+    int64 ticks = 0;
+
+    for (; graph.cycle < cycles; ++graph.cycle)
+    {
+        // give the workers time to go to sleep now and then
+        if (graph.cycle % 100 == 99)
+            Thread::sleep (2);
+
+        const int64 start = Time::getHighResolutionTicks();
+        scheduler.process (graph);
+        ticks += Time::getHighResolutionTicks() - start;
+
+        const int task = graph.findMiscountedTask();
+        if (task >= 0)
+            return fail ("scheduler: task " + String (task) + " didn't run once in cycle " + String (graph.cycle));
+        if (graph.earlyRuns.load() > 0)
+            return fail ("scheduler: a task ran before its dependencies in cycle " + String (graph.cycle));
+    }
+
+    LayeredTaskGraph serial (numLayers, width);
+    const double serialNanos = nanosPerItem (cycles, [&] {
+        for (int c = 0; c < cycles; ++c, ++serial.cycle)
+            for (int t = 0; t < serial.getNumTasks(); ++t)
+                serial.runTask (t);
+    });
+
+    std::cout << "scheduler: " << numThreads << " threads ran " << cycles << " cycles of "
+              << numLayers * width << " tasks, each once per cycle in dependency order" << std::endl;
+    printTiming ("cycle, serial vs pool", serialNanos,
+                 Time::highResolutionTicksToSeconds (ticks) * 1.0e9 / cycles);
+    return true;
+}
+
+//=============================================================================
+/** Amps chained through a ModuleGraph must apply their gains in order.
+
+    Two amps in parallel from the graph input both feed a third, so its
+    input is a mix of both outputs while the others read theirs in place:
+    out = in * (gainA + gainB) * gainC
+ */
+bool benchGraph()
+{
+    const double sampleRate = 48000.0;
+    const int blockSize = 256;
+    const float dbA = -6.f, dbB = -12.f, dbC = 3.f;
+
+    jlv2::LV2PluginFormat format;
+    jlv2::ModuleGraph graph (1, 1);
+    const int io = jlv2::ModuleGraph::GraphIO;
+
+    String error;
+    const int a = graph.addPlugin (format, ampURI, error);
+    if (a == io)
+        return skip ("graph", String (ampURI) + " isn't available: " + error);
+    const int b = graph.addPlugin (format, ampURI, error);
+    const int c = graph.addPlugin (format, ampURI, error);
+    if (b == io || c == io)
+        return fail ("graph: " + error);
+
+    auto in   = [&graph] (int node) { return graph.getAudioPort (node, 0, true); };
+    auto out  = [&graph] (int node) { return graph.getAudioPort (node, 0, false); };
+    auto gain = [&graph] (int node) { return graph.getPortIndex (node, "gain"); };
+
+    if (! graph.connect (io, 0, a, in (a)) || ! graph.connect (io, 0, b, in (b))
+         || ! graph.connect (a, out (a), c, in (c)) || ! graph.connect (b, out (b), c, in (c))
+         || ! graph.connect (c, out (c), io, 0))
+        return fail ("graph: couldn't connect the amps");
+
+    if (graph.connect (c, out (c), a, in (a)))
+        return fail ("graph: accepted a connection making a cycle");
+
+    const Array<int> order (graph.getRenderOrder());
+    if (order.size() != 3 || order.getLast() != c)
+        return fail ("graph: the mixing amp isn't rendered last");
+
+    if (! graph.setControlValue (a, gain (a), dbA) || ! graph.setControlValue (b, gain (b), dbB)
+         || ! graph.setControlValue (c, gain (c), dbC))
+        return fail ("graph: couldn't set the gains");
+
+    graph.prepareToPlay (sampleRate, blockSize);
+
+    AudioSampleBuffer audio (1, blockSize);
+    MidiBuffer midi;
+    const float expected = (ampGain (dbA) + ampGain (dbB)) * ampGain (dbC);
+
+    // the second half runs the independent amps in parallel
+    jlv2::ProcessScheduler scheduler (2);
+
+    for (int cycle = 0; cycle < 8; ++cycle)
+    {
+        if (cycle == 4)
+            graph.setScheduler (&scheduler);
+
+        for (int i = 0; i < blockSize; ++i)
+            audio.setSample (0, i, 1.f);
+        graph.process (audio, midi);
+
+        for (int i = 0; i < blockSize; ++i)
+            if (std::abs (audio.getSample (0, i) - expected) > expected * 1.0e-4f)
+                return fail ("graph: cycle " + String (cycle) + " sample " + String (i) + " is "
+                             + String (audio.getSample (0, i)) + ", expected " + String (expected));
+    }
+
+    graph.releaseResources();
+    graph.setScheduler (nullptr);
+    std::cout << "graph: serially and on a scheduler, two amps mixed into a third gave " << expected << " per input sample" << std::endl;
+    return true;
+}
+
+//=============================================================================
+struct Mode
+{
+    const char* name;
+    const char* description;
+    bool (*run)();
+};
+
+const Mode modes[] =
+{
+    { "convert", "double/float sample conversion against the JUCE fallback", benchConvert },
+    { "ring",    "RingBuffer stress and throughput against the AbstractFifo one", benchRing },
+    { "mpsc",    "MultiProducerQueue ordering and payloads with several writers", benchMultiProducer },
+    { "symbols", "SymbolMap threaded stress and map/unmap against the unordered_map one", benchSymbols },
+    { "automation", "sample accurate controller automation of eg-amp", benchAutomation },
+    { "scheduler", "work stealing scheduler running a wide task graph on several threads", benchScheduler },
+    { "graph",   "eg-amps routed and mixed through a ModuleGraph", benchGraph },
+};
+
+void printUsage()
+{
+    std::cout << "usage: lv2hostbench [MODE ...]" << std::endl
+              << std::endl
+              << "Stress tests and microbenchmarks for the host's realtime internals. Runs" << std::endl
+              << "every mode when none is given and exits non-zero if a check fails." << std::endl
+              << "Modes that host a plugin use the LV2 example amp and are skipped" << std::endl
+              << "without it." << std::endl
+              << std::endl;
+    for (const auto& mode : modes)
+        std::cout << "  " << String (mode.name).paddedRight (' ', 22) << mode.description << std::endl;
+}
+
+}
+
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (CharPointer_UTF8 (argv[i]));
+
+    if (args.contains ("-h") || args.contains ("--help"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    for (const auto& arg : args)
+    {
+        if (std::none_of (std::begin (modes), std::end (modes),
+                          [&arg] (const Mode& m) { return arg == m.name; }))
+        {
+            std::cerr << "lv2hostbench: unknown mode: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    ScopedJuceInitialiser_GUI juceInit;
+    bool ok = true;
+    for (const auto& mode : modes)
+        if (args.isEmpty() || args.contains (mode.name))
+            ok = mode.run() && ok;
+
+    return ok ? 0 : 1;
+}
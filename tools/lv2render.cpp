@@ -0,0 +1,250 @@
+#include <juce/juce.h>
+#include <jlv2/jlv2.h>
+#include <iostream>
+
+using namespace juce;
+
+namespace {
+
+struct RenderOptions
+{
+    File input, output;
+    int blockSize = 8192;
+    int bitDepth  = 24;
+    double tailSeconds = 0.0;
+    StringArray plugins;    ///< plugin URIs in processing order
+    StringArray states;     ///< state file per plugin, may be empty
+
+    bool parse (const StringArray& args, String& error)
+    {
+        for (int i = 0; i < args.size(); ++i)
+        {
+            const auto& arg = args[i];
+            const bool hasValue = i + 1 < args.size();
+
+            if ((arg == "-i" || arg == "--input") && hasValue)
+                input = File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+            else if ((arg == "-o" || arg == "--output") && hasValue)
+                output = File::getCurrentWorkingDirectory().getChildFile (args[++i]);
+            else if ((arg == "-b" || arg == "--block-size") && hasValue)
+                blockSize = args[++i].getIntValue();
+            else if ((arg == "-d" || arg == "--bit-depth") && hasValue)
+                bitDepth = args[++i].getIntValue();
+            else if ((arg == "-t" || arg == "--tail") && hasValue)
+                tailSeconds = args[++i].getDoubleValue();
+            else if ((arg == "-s" || arg == "--state") && hasValue)
+            {
+                if (plugins.isEmpty())
+                    return fail (error, "--state must follow the plugin it belongs to");
+                states.set (plugins.size() - 1, args[++i]);
+            }
+            else if (arg.startsWith ("-"))
+                return fail (error, "unknown option: " + arg);
+            else
+            {
+                plugins.add (arg);
+                states.add (String());
+            }
+        }
+
+        if (! input.existsAsFile())
+            return fail (error, "input file not found: " + input.getFullPathName());
+        if (output == File())
+            return fail (error, "no output file given");
+        if (blockSize <= 0)
+            return fail (error, "invalid block size");
+        return true;
+    }
+
+    static bool fail (String& error, const String& message)
+    {
+        error = message;
+        return false;
+    }
+};
+
+void printUsage()
+{
+    std::cout << "usage: lv2render -i INPUT -o OUTPUT [options] URI [--state FILE] [URI ...]" << std::endl
+              << std::endl
+              << "Streams an audio file through a chain of LV2 plugins as fast as possible." << std::endl
+              << std::endl
+              << "  -i, --input FILE        WAV or AIFF file to read" << std::endl
+              << "  -o, --output FILE       file to write, the format follows the extension" << std::endl
+              << "  -b, --block-size N      frames per cycle (default 8192)" << std::endl
+              << "  -d, --bit-depth N       output bit depth (default 24)" << std::endl
+              << "  -t, --tail SECONDS      extra time to render after the input ends" << std::endl
+              << "  -s, --state FILE        restore state saved by lv2show for the preceding plugin" << std::endl;
+}
+
+int render (const RenderOptions& opts)
+{
+    AudioFormatManager formats;
+    formats.registerBasicFormats();
+
+    AudioPluginFormatManager plugins;
+    plugins.addFormat (new jlv2::LV2PluginFormat());
+
+    TimeSliceThread readThread ("lv2render: read-ahead");
+    TimeSliceThread writeThread ("lv2render: write");
+    readThread.startThread (5);
+    writeThread.startThread (5);
+
+    AudioFormatReader* const source = formats.createReaderFor (opts.input);
+    if (source == nullptr)
+    {
+        std::cerr << "lv2render: can't read " << opts.input.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    const double sampleRate = source->sampleRate;
+    const int64 inputLength = source->lengthInSamples;
+    const int inputChannels = (int) source->numChannels;
+
+    // takes ownership of the source and reads it ahead on its own thread
+    BufferingAudioReader reader (source, readThread, opts.blockSize * 8);
+    reader.setReadTimeout (-1);
+
+    OwnedArray<AudioPluginInstance> chain;
+    int numChannels  = inputChannels;
+    int outChannels  = inputChannels;
+    int64 latency    = 0;
+
+    for (int i = 0; i < opts.plugins.size(); ++i)
+    {
+        PluginDescription desc;
+        desc.pluginFormatName = "LV2";
+        desc.fileOrIdentifier = opts.plugins[i];
+
+        String message;
+        auto instance = plugins.createPluginInstance (desc, sampleRate, opts.blockSize, message);
+        if (instance == nullptr)
+        {
+            std::cerr << "lv2render: " << opts.plugins[i] << ": " << message << std::endl;
+            return 1;
+        }
+
+        instance->setNonRealtime (true);
+        instance->prepareToPlay (sampleRate, opts.blockSize);
+
+        if (opts.states[i].isNotEmpty())
+        {
+            MemoryBlock state;
+            if (! File::getCurrentWorkingDirectory().getChildFile (opts.states[i]).loadFileAsData (state))
+            {
+                std::cerr << "lv2render: can't read state " << opts.states[i] << std::endl;
+                return 1;
+            }
+
+            instance->setStateInformation (state.getData(), (int) state.getSize());
+        }
+
+        numChannels = jmax (numChannels, instance->getTotalNumInputChannels(),
+                                         instance->getTotalNumOutputChannels());
+        outChannels = instance->getTotalNumOutputChannels();
+        latency    += instance->getLatencySamples();
+        chain.add (instance.release());
+    }
+
+    if (outChannels <= 0)
+    {
+        std::cerr << "lv2render: the chain has no audio outputs" << std::endl;
+        return 1;
+    }
+
+    auto* const format = formats.findFormatForFileExtension (opts.output.getFileExtension());
+    if (format == nullptr)
+    {
+        std::cerr << "lv2render: unknown output format " << opts.output.getFileExtension() << std::endl;
+        return 1;
+    }
+
+    opts.output.deleteFile();
+    std::unique_ptr<FileOutputStream> stream (opts.output.createOutputStream());
+    AudioFormatWriter* const writer = stream != nullptr
+        ? format->createWriterFor (stream.get(), sampleRate, (unsigned int) outChannels, opts.bitDepth, {}, 0)
+        : nullptr;
+    if (writer == nullptr)
+    {
+        std::cerr << "lv2render: can't write " << opts.output.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    stream.release();   // now owned by the writer
+    std::unique_ptr<AudioFormatWriter::ThreadedWriter> output (
+        new AudioFormatWriter::ThreadedWriter (writer, writeThread, opts.blockSize * 8));
+
+    AudioSampleBuffer buffer (numChannels, opts.blockSize);
+    MidiBuffer midi;
+    HeapBlock<const float*> channels (outChannels);
+
+    // plugin latency is rendered past the end and trimmed from the start
+    const int64 tailLength = (int64) (opts.tailSeconds * sampleRate);
+    const int64 totalLength = inputLength + tailLength + latency;
+    const double started = Time::getMillisecondCounterHiRes();
+
+    for (int64 pos = 0; pos < totalLength;)
+    {
+        const int numSamples = (int) jmin ((int64) opts.blockSize, totalLength - pos);
+        AudioSampleBuffer block (buffer.getArrayOfWritePointers(), numChannels, numSamples);
+        block.clear();
+
+        if (pos < inputLength)
+            reader.read (&block, 0, (int) jmin ((int64) numSamples, inputLength - pos), pos, true, true);
+
+        for (auto* plugin : chain)
+        {
+            midi.clear();
+            plugin->processBlock (block, midi);
+            for (int c = plugin->getTotalNumOutputChannels(); c < numChannels; ++c)
+                block.clear (c, 0, numSamples);
+        }
+
+        const int skip = (int) jlimit ((int64) 0, (int64) numSamples, latency - pos);
+        for (int c = 0; c < outChannels; ++c)
+            channels[c] = block.getReadPointer (c, jmin (skip, numSamples - 1));
+
+        if (skip < numSamples)
+            while (! output->write (channels.getData(), numSamples - skip))
+                Thread::sleep (1);
+
+        pos += numSamples;
+    }
+
+    output.reset();     // flushes the remaining samples
+
+    for (auto* plugin : chain)
+        plugin->releaseResources();
+
+    const double seconds = (Time::getMillisecondCounterHiRes() - started) / 1000.0;
+    const double rendered = (double) (inputLength + tailLength) / sampleRate;
+    std::cout << "lv2render: rendered " << rendered << "s in " << seconds << "s ("
+              << (seconds > 0.0 ? rendered / seconds : 0.0) << "x realtime)" << std::endl;
+    return 0;
+}
+
+}
+
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (CharPointer_UTF8 (argv[i]));
+
+    if (args.isEmpty() || args.contains ("-h") || args.contains ("--help"))
+    {
+        printUsage();
+        return args.isEmpty() ? 1 : 0;
+    }
+
+    RenderOptions opts;
+    String error;
+    if (! opts.parse (args, error))
+    {
+        std::cerr << "lv2render: " << error << std::endl;
+        return 1;
+    }
+
+    ScopedJuceInitialiser_GUI juceInit;
+    return render (opts);
+}